@@ -0,0 +1,302 @@
+#include "deadlock.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <thread>
+
+#include "index.h"
+#include "optimize.h"
+
+namespace flow {
+
+DeadlockReport::DeadlockReport() {
+	deadlock = false;
+	complete = false;
+	states = 0;
+}
+
+DeadlockReport::~DeadlockReport() {
+}
+
+// Tokens an arc can hold, like the capacity of its place in a MarkedGraph
+int arcCapacity(const Graph &graph, const Arc &arc) {
+	const Func &producer = graph.funcs[graph.nodes[arc.from]];
+	if (arc.fromPort >= 0 and arc.fromPort < (int)producer.nets.size()) {
+		const Net &net = producer.nets[arc.fromPort];
+		if (net.protocol == Net::Protocol::CREDIT) {
+			return std::max(net.credits, 1);
+		} else if (net.queueDepth() > 0) {
+			return net.queueDepth()+1;
+		}
+	}
+	return 1;
+}
+
+// A field of a packed state
+struct Field {
+	int offset;
+	int width;
+
+	uint64_t get(const uint64_t *state) const {
+		if (width == 0) {
+			return 0;
+		}
+		uint64_t value = state[offset/64] >> (offset%64);
+		if (offset%64 + width > 64) {
+			value |= state[offset/64+1] << (64 - offset%64);
+		}
+		return value & ((width < 64 ? ((uint64_t)1 << width) : 0) - 1);
+	}
+
+	void set(uint64_t *state, uint64_t value) const {
+		if (width == 0) {
+			return;
+		}
+		uint64_t mask = (width < 64 ? ((uint64_t)1 << width) : 0) - 1;
+		state[offset/64] = (state[offset/64] & ~(mask << (offset%64))) | (value << (offset%64));
+		if (offset%64 + width > 64) {
+			int shift = 64 - offset%64;
+			state[offset/64+1] = (state[offset/64+1] & ~(mask >> shift)) | (value >> shift);
+		}
+	}
+};
+
+// What firing a Condition needs and does, by arc
+struct Firing {
+	int node;
+	int cond;
+	// valid arcs the Condition reads or acknowledges
+	vector<int> reads;
+	vector<int> acks;
+	vector<int> writes;
+};
+
+DeadlockReport findDeadlock(const Graph &graph, int64_t maxStates, int threads) {
+	DeadlockReport report;
+	GraphIndex index(graph);
+	int nodes = index.nodes;
+
+	// Layout of the packed state
+	vector<Field> arcField(graph.arcs.size(), Field{0, 0});
+	vector<Field> nodeField(nodes, Field{0, 0});
+	vector<int> capacity(graph.arcs.size(), 0);
+	int bits = 0;
+	for (int node = 0; node < nodes; node++) {
+		for (int arc : index.fanout(node)) {
+			capacity[arc] = arcCapacity(graph, graph.arcs[arc]);
+			arcField[arc] = Field{bits, (int)std::bit_width((unsigned)capacity[arc])};
+			bits += arcField[arc].width;
+		}
+	}
+	for (int node = 0; node < nodes; node++) {
+		int conds = (int)graph.funcs[graph.nodes[node]].conds.size();
+		nodeField[node] = Field{bits, (int)std::bit_width((unsigned)std::max(conds-1, 0))};
+		bits += nodeField[node].width;
+	}
+	int words = std::max((bits+63)/64, 1);
+
+	vector<Firing> firings;
+	for (int node = 0; node < nodes; node++) {
+		const Func &func = graph.funcs[graph.nodes[node]];
+		for (int condIdx = 0; condIdx < (int)func.conds.size(); condIdx++) {
+			const Condition &cond = func.conds[condIdx];
+			if (isUnsatisfiable(cond.valid)) {
+				continue;
+			}
+
+			Firing firing;
+			firing.node = node;
+			firing.cond = condIdx;
+			auto read = [&](int net) {
+				int arc = index.arcTo(node, net);
+				if (arc >= 0 and std::find(firing.reads.begin(), firing.reads.end(), arc) == firing.reads.end()) {
+					firing.reads.push_back(arc);
+				}
+			};
+			for (size_t net : getNetsInExpression(cond.valid)) {
+				read((int)net);
+			}
+			for (auto reg = cond.regs.begin(); reg != cond.regs.end(); reg++) {
+				for (size_t net : getNetsInExpression(reg->second)) {
+					read((int)net);
+				}
+			}
+			for (auto out = cond.outs.begin(); out != cond.outs.end(); out++) {
+				for (size_t net : getNetsInExpression(out->second)) {
+					read((int)net);
+				}
+				int arc = index.arcFrom(node, out->first);
+				if (arc >= 0) {
+					firing.writes.push_back(arc);
+				}
+			}
+			for (auto in = cond.ins.begin(); in != cond.ins.end(); in++) {
+				read(*in);
+				int arc = index.arcTo(node, *in);
+				if (arc >= 0) {
+					firing.acks.push_back(arc);
+				}
+			}
+			firings.push_back(firing);
+		}
+	}
+
+	// Every state found, with the state and firing it was reached from. Ids
+	// are handed out before a state is published to the table, so an id
+	// that lost a race to an equal state is left as a hole with no parent.
+	maxStates = std::max(maxStates, (int64_t)1);
+	vector<uint64_t> states((size_t)maxStates*words, 0);
+	vector<int64_t> parent(maxStates, -2);
+	vector<int> firedBy(maxStates, -1);
+	std::atomic<int64_t> allocated(0);
+	std::atomic<int64_t> inserted(0);
+	std::atomic<bool> overflow(false);
+
+	size_t tableSize = std::bit_ceil((size_t)maxStates*2);
+	std::unique_ptr<std::atomic<int64_t>[]> table(new std::atomic<int64_t>[tableSize]);
+	for (size_t slot = 0; slot < tableSize; slot++) {
+		table[slot].store(0, std::memory_order_relaxed);
+	}
+
+	auto hashOf = [&](const uint64_t *state) {
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (int w = 0; w < words; w++) {
+			hash = (hash ^ state[w])*0x100000001b3ull;
+			hash ^= hash >> 29;
+		}
+		return hash;
+	};
+
+	// Returns the id of a newly found state, -1 if it was seen before or
+	// there is no room left
+	auto insert = [&](const uint64_t *state, int64_t from, int firing) -> int64_t {
+		int64_t id = -1;
+		for (size_t slot = hashOf(state) & (tableSize-1); ; slot = (slot+1) & (tableSize-1)) {
+			int64_t entry = table[slot].load(std::memory_order_acquire);
+			if (entry == 0) {
+				if (id < 0) {
+					id = allocated.fetch_add(1);
+					if (id >= maxStates) {
+						overflow = true;
+						return -1;
+					}
+					std::copy(state, state+words, &states[(size_t)id*words]);
+					parent[id] = from;
+					firedBy[id] = firing;
+				}
+				if (table[slot].compare_exchange_strong(entry, id+1, std::memory_order_acq_rel)) {
+					inserted.fetch_add(1, std::memory_order_relaxed);
+					return id;
+				}
+			}
+			if (std::equal(state, state+words, &states[(size_t)(entry-1)*words])) {
+				if (id >= 0) {
+					parent[id] = -2;
+				}
+				return -1;
+			}
+		}
+	};
+
+	vector<uint64_t> reset(words, 0);
+	vector<int64_t> frontier(1, insert(reset.data(), -1, -1));
+	std::atomic<int64_t> found(-1);
+
+	if (threads <= 0) {
+		threads = (int)std::thread::hardware_concurrency();
+	}
+	threads = std::max(threads, 1);
+
+	while (not frontier.empty() and found < 0 and not overflow) {
+		vector<vector<int64_t> > next(threads);
+		auto expand = [&](int t) {
+			vector<uint64_t> succ(words);
+			for (size_t i = t; i < frontier.size() and found < 0; i += threads) {
+				int64_t id = frontier[i];
+				const uint64_t *state = &states[(size_t)id*words];
+				bool enabled = false;
+				for (int f = 0; f < (int)firings.size(); f++) {
+					const Firing &firing = firings[f];
+					bool ready = true;
+					for (auto arc = firing.reads.begin(); ready and arc != firing.reads.end(); arc++) {
+						ready = arcField[*arc].get(state) > 0;
+					}
+					for (auto arc = firing.writes.begin(); ready and arc != firing.writes.end(); arc++) {
+						ready = arcField[*arc].get(state) < (uint64_t)capacity[*arc];
+					}
+					if (not ready) {
+						continue;
+					}
+
+					std::copy(state, state+words, succ.begin());
+					for (auto arc = firing.writes.begin(); arc != firing.writes.end(); arc++) {
+						arcField[*arc].set(succ.data(), arcField[*arc].get(state)+1);
+					}
+					if (nodeField[firing.node].get(state) == (uint64_t)firing.cond) {
+						for (auto arc = firing.acks.begin(); arc != firing.acks.end(); arc++) {
+							arcField[*arc].set(succ.data(), arcField[*arc].get(succ.data())-1);
+						}
+					}
+					nodeField[firing.node].set(succ.data(), firing.cond);
+
+					// firing into and out of the environment alone goes nowhere
+					if (std::equal(succ.begin(), succ.end(), state)) {
+						continue;
+					}
+					enabled = true;
+
+					int64_t succId = insert(succ.data(), id, f);
+					if (succId >= 0) {
+						next[t].push_back(succId);
+					}
+				}
+
+				if (not enabled) {
+					int64_t none = -1;
+					found.compare_exchange_strong(none, id);
+				}
+			}
+		};
+
+		if (threads == 1 or frontier.size() < 64) {
+			for (int t = 0; t < threads; t++) {
+				expand(t);
+			}
+		} else {
+			vector<std::thread> workers;
+			for (int t = 0; t < threads; t++) {
+				workers.push_back(std::thread(expand, t));
+			}
+			for (auto worker = workers.begin(); worker != workers.end(); worker++) {
+				worker->join();
+			}
+		}
+
+		frontier.clear();
+		for (auto states = next.begin(); states != next.end(); states++) {
+			frontier.insert(frontier.end(), states->begin(), states->end());
+		}
+	}
+
+	report.states = inserted.load();
+	report.deadlock = found >= 0;
+	report.complete = not overflow and frontier.empty();
+	if (report.deadlock) {
+		const uint64_t *state = &states[(size_t)found*words];
+		for (size_t arc = 0; arc < graph.arcs.size(); arc++) {
+			report.tokens.push_back((int)arcField[arc].get(state));
+		}
+		for (int node = 0; node < nodes; node++) {
+			report.branches.push_back((int)nodeField[node].get(state));
+		}
+		for (int64_t id = found; parent[id] >= 0; id = parent[id]) {
+			report.trace.push_back({firings[firedBy[id]].node, firings[firedBy[id]].cond});
+		}
+		std::reverse(report.trace.begin(), report.trace.end());
+	}
+	return report;
+}
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "graph.h"
+
+namespace flow {
+
+// Explicit state model of the handshakes of a Graph. The state is the
+// number of tokens on every arc, up to what its channel can hold, and the
+// branch_id of every node. Data is abstracted away, so any Condition whose
+// guard isn't constant false may fire once the inputs it reads are valid
+// and the outputs it writes have room. As in the synthesized Module, a
+// branch other than the one in branch_id writes its outputs and takes over
+// branch_id, but only acknowledges its inputs once it is selected. Ports
+// without an arc are left to an environment that always has a token and
+// always has room.
+struct DeadlockReport {
+	struct Step {
+		int node;
+		int cond;
+	};
+
+	DeadlockReport();
+	~DeadlockReport();
+
+	// A reachable state that no Condition of any node can leave. Firings that
+	// only trade tokens with the environment don't count.
+	bool deadlock;
+
+	// Every reachable state was explored, so no deadlock means there is none
+	bool complete;
+
+	// Distinct states found
+	int64_t states;
+
+	// Shortest sequence of firings from reset to the deadlock, and the
+	// tokens on every arc and branch_id of every node once there
+	vector<Step> trace;
+	vector<int> tokens;
+	vector<int> branches;
+};
+
+// Breadth first search of the states reachable from reset, a level at a
+// time over threads, 0 for one per core. States are packed into 64 bit
+// words and deduplicated in a lock free hash table. Gives up after
+// maxStates allocations. A thread that loses a race to insert a state
+// keeps the slot it allocated, so with threads the search may stop short
+// of maxStates distinct states.
+DeadlockReport findDeadlock(const Graph &graph, int64_t maxStates=(int64_t)1 << 20, int threads=0);
+
+}
@@ -0,0 +1,373 @@
+#pragma once
+
+#include <compare>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace flow {
+
+// Native value of a FIXED or BITS flow::Type for simulation. Holds Width
+// unsigned bits that stand for bits*2^Shift. Arithmetic works on the
+// stored bits and wraps around at Width bits like the hardware does, so
+// lining up the shifts of two values is up to the caller, see as(). Up to
+// 64 bits this is a single word whose mask is a compile time constant,
+// wider values are kept in little endian 64 bit limbs.
+template <int Width, int Shift=0>
+struct Fixed {
+	static_assert(Width > 0, "Fixed needs at least one bit");
+
+	static constexpr int width = Width;
+	static constexpr int shift = Shift;
+	static constexpr int limbs = (Width+63)/64;
+	// bits of the top limb that are in use
+	static constexpr uint64_t topMask = Width%64 == 0 ? ~(uint64_t)0 : ((uint64_t)1 << (Width%64)) - 1;
+
+	// 16 byte aligned past one limb for the SSE2 loads
+	alignas(limbs > 1 ? 16 : 8) uint64_t limb[limbs];
+
+	Fixed() : limb{} {
+	}
+
+	// From the stored bits, not the value they stand for
+	Fixed(uint64_t bits) : limb{} {
+		limb[0] = bits;
+		normalize();
+	}
+
+	// From limbs words of stored bits, least significant first
+	static Fixed ofBits(const uint64_t *words) {
+		Fixed result;
+		for (int i = 0; i < limbs; i++) {
+			result.limb[i] = words[i];
+		}
+		result.normalize();
+		return result;
+	}
+
+	// Clear the bits above Width, every operation that could set them ends
+	// with this
+	void normalize() {
+		limb[limbs-1] &= topMask;
+	}
+
+	bool bit(int i) const {
+		return i >= 0 and i < Width and ((limb[i/64] >> (i%64)) & 1);
+	}
+
+	uint64_t low() const {
+		return limb[0];
+	}
+
+	bool isZero() const {
+		for (int i = 0; i < limbs; i++) {
+			if (limb[i] != 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// The value with W bits and shift S, truncating the bits that fall off
+	// either end
+	template <int W, int S>
+	Fixed<W, S> as() const {
+		constexpr int n = limbs + Fixed<W, S>::limbs;
+		uint64_t words[n] = {};
+		for (int i = 0; i < limbs; i++) {
+			words[i] = limb[i];
+		}
+		shiftLimbs(words, n, Shift - S);
+		return Fixed<W, S>::ofBits(words);
+	}
+
+	// The value this stands for, rounded to a double
+	double toReal() const {
+		double result = 0.0;
+		for (int i = limbs-1; i >= 0; i--) {
+			result = result*18446744073709551616.0 + (double)limb[i];
+		}
+		return std::ldexp(result, Shift);
+	}
+
+	// Stored bits in hex
+	std::string to_string() const {
+		static const char digits[] = "0123456789abcdef";
+		std::string result;
+		for (int i = (Width+3)/4 - 1; i >= 0; i--) {
+			int digit = (int)((limb[i/16] >> (4*(i%16))) & 0xF);
+			if (digit != 0 or not result.empty() or i == 0) {
+				result.push_back(digits[digit]);
+			}
+		}
+		return "0x" + result;
+	}
+
+	Fixed &operator+=(const Fixed &b) {
+		if constexpr (limbs == 1) {
+			limb[0] += b.limb[0];
+		} else {
+			unsigned char carry = 0;
+			for (int i = 0; i < limbs; i++) {
+				carry = addCarry(carry, limb[i], b.limb[i], limb[i]);
+			}
+		}
+		normalize();
+		return *this;
+	}
+
+	Fixed &operator-=(const Fixed &b) {
+		if constexpr (limbs == 1) {
+			limb[0] -= b.limb[0];
+		} else {
+			// a + ~b + 1
+			unsigned char carry = 1;
+			for (int i = 0; i < limbs; i++) {
+				carry = addCarry(carry, limb[i], ~b.limb[i], limb[i]);
+			}
+		}
+		normalize();
+		return *this;
+	}
+
+	Fixed &operator*=(const Fixed &b) {
+		if constexpr (limbs == 1) {
+			limb[0] *= b.limb[0];
+		} else {
+			// schoolbook, dropping the partial products past the top limb
+			uint64_t result[limbs] = {};
+			for (int i = 0; i < limbs; i++) {
+				uint64_t carry = 0;
+				for (int j = 0; i+j < limbs; j++) {
+					uint64_t hi = 0;
+					uint64_t lo = mulWide(limb[i], b.limb[j], hi);
+					unsigned char c0 = addCarry(0, result[i+j], lo, result[i+j]);
+					unsigned char c1 = addCarry(0, result[i+j], carry, result[i+j]);
+					// the full product plus both carries still fits in 128 bits
+					carry = hi + c0 + c1;
+				}
+			}
+			for (int i = 0; i < limbs; i++) {
+				limb[i] = result[i];
+			}
+		}
+		normalize();
+		return *this;
+	}
+
+	// Division by zero gives zero for both the quotient and remainder
+	Fixed &operator/=(const Fixed &b) {
+		Fixed remainder;
+		divide(*this, b, *this, remainder);
+		return *this;
+	}
+
+	Fixed &operator%=(const Fixed &b) {
+		Fixed quotient;
+		divide(*this, b, quotient, *this);
+		return *this;
+	}
+
+	Fixed &operator&=(const Fixed &b) {
+		for (int i = 0; i < limbs; i++) {
+			limb[i] &= b.limb[i];
+		}
+		return *this;
+	}
+
+	Fixed &operator|=(const Fixed &b) {
+		for (int i = 0; i < limbs; i++) {
+			limb[i] |= b.limb[i];
+		}
+		return *this;
+	}
+
+	Fixed &operator^=(const Fixed &b) {
+		for (int i = 0; i < limbs; i++) {
+			limb[i] ^= b.limb[i];
+		}
+		return *this;
+	}
+
+	// Logical shifts of the stored bits
+	Fixed &operator<<=(int n) {
+		if constexpr (limbs == 1) {
+			limb[0] = n >= 64 ? 0 : limb[0] << n;
+		} else {
+			shiftLimbs(limb, limbs, n);
+		}
+		normalize();
+		return *this;
+	}
+
+	Fixed &operator>>=(int n) {
+		if constexpr (limbs == 1) {
+			limb[0] = n >= 64 ? 0 : limb[0] >> n;
+		} else {
+			shiftLimbs(limb, limbs, -n);
+		}
+		return *this;
+	}
+
+	Fixed operator~() const {
+		Fixed result;
+		for (int i = 0; i < limbs; i++) {
+			result.limb[i] = ~limb[i];
+		}
+		result.normalize();
+		return result;
+	}
+
+	Fixed operator-() const {
+		return Fixed() - *this;
+	}
+
+	friend Fixed operator+(Fixed a, const Fixed &b) { return a += b; }
+	friend Fixed operator-(Fixed a, const Fixed &b) { return a -= b; }
+	friend Fixed operator*(Fixed a, const Fixed &b) { return a *= b; }
+	friend Fixed operator/(Fixed a, const Fixed &b) { return a /= b; }
+	friend Fixed operator%(Fixed a, const Fixed &b) { return a %= b; }
+	friend Fixed operator&(Fixed a, const Fixed &b) { return a &= b; }
+	friend Fixed operator|(Fixed a, const Fixed &b) { return a |= b; }
+	friend Fixed operator^(Fixed a, const Fixed &b) { return a ^= b; }
+	friend Fixed operator<<(Fixed a, int n) { return a <<= n; }
+	friend Fixed operator>>(Fixed a, int n) { return a >>= n; }
+
+	friend bool operator==(const Fixed &a, const Fixed &b) {
+		if constexpr (limbs == 1) {
+			return a.limb[0] == b.limb[0];
+		} else {
+			return highestDifference(a.limb, b.limb) < 0;
+		}
+	}
+
+	// Unsigned, like the hardware compares
+	friend std::strong_ordering operator<=>(const Fixed &a, const Fixed &b) {
+		int i = limbs == 1 ? 0 : highestDifference(a.limb, b.limb);
+		return i < 0 ? std::strong_ordering::equal : a.limb[i] <=> b.limb[i];
+	}
+
+	// out = a + b + carry, returns the carry out
+	static unsigned char addCarry(unsigned char carry, uint64_t a, uint64_t b, uint64_t &out) {
+#if defined(__x86_64__)
+		unsigned long long sum = 0;
+		carry = _addcarry_u64(carry, a, b, &sum);
+		out = sum;
+		return carry;
+#else
+		uint64_t sum = a + b;
+		uint64_t result = sum + carry;
+		out = result;
+		return (sum < a) | (result < sum);
+#endif
+	}
+
+	// Low word of a*b, with the high word in hi
+	static uint64_t mulWide(uint64_t a, uint64_t b, uint64_t &hi) {
+#if defined(__SIZEOF_INT128__)
+		unsigned __int128 product = (unsigned __int128)a*b;
+		hi = (uint64_t)(product >> 64);
+		return (uint64_t)product;
+#else
+		uint64_t a0 = (uint32_t)a, a1 = a >> 32;
+		uint64_t b0 = (uint32_t)b, b1 = b >> 32;
+		uint64_t p00 = a0*b0, p01 = a0*b1, p10 = a1*b0, p11 = a1*b1;
+		uint64_t mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+		hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+		return (mid << 32) | (uint32_t)p00;
+#endif
+	}
+
+	// Shift the n words left by the given number of bits, or right if it is
+	// negative
+	static void shiftLimbs(uint64_t *words, int n, int by) {
+		if (by > 0) {
+			int w = by/64, b = by%64;
+			for (int i = n-1; i >= 0; i--) {
+				uint64_t hi = i-w >= 0 ? words[i-w] : 0;
+				uint64_t lo = i-w-1 >= 0 ? words[i-w-1] : 0;
+				words[i] = b == 0 ? hi : (hi << b) | (lo >> (64-b));
+			}
+		} else if (by < 0) {
+			int w = (-by)/64, b = (-by)%64;
+			for (int i = 0; i < n; i++) {
+				uint64_t lo = i+w < n ? words[i+w] : 0;
+				uint64_t hi = i+w+1 < n ? words[i+w+1] : 0;
+				words[i] = b == 0 ? lo : (lo >> b) | (hi << (64-b));
+			}
+		}
+	}
+
+	// Most significant limb where a and b differ, -1 if they are equal.
+	// With SSE2 two limbs are checked at a time.
+	static int highestDifference(const uint64_t *a, const uint64_t *b) {
+		int i = limbs;
+#if defined(__SSE2__)
+		if (i%2 == 1) {
+			i--;
+			if (a[i] != b[i]) {
+				return i;
+			}
+		}
+		for (; i >= 2; i -= 2) {
+			__m128i x = _mm_load_si128((const __m128i*)(a+i-2));
+			__m128i y = _mm_load_si128((const __m128i*)(b+i-2));
+			int same = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+			if (same != 0xFFFF) {
+				return (same & 0xFF00) != 0xFF00 ? i-1 : i-2;
+			}
+		}
+#endif
+		for (; i > 0; i--) {
+			if (a[i-1] != b[i-1]) {
+				return i-1;
+			}
+		}
+		return -1;
+	}
+
+	static void divide(const Fixed &a, const Fixed &b, Fixed &quotient, Fixed &remainder) {
+		if (b.isZero()) {
+			quotient = Fixed();
+			remainder = Fixed();
+			return;
+		}
+
+		if constexpr (limbs == 1) {
+			uint64_t q = a.limb[0]/b.limb[0];
+			uint64_t r = a.limb[0]%b.limb[0];
+			quotient.limb[0] = q;
+			remainder.limb[0] = r;
+		} else {
+			// restoring division a bit at a time, the remainder needs one bit
+			// more than Width before it is compared
+			typedef Fixed<Width+1, 0> Wide;
+			Wide r, d;
+			for (int i = 0; i < limbs; i++) {
+				d.limb[i] = b.limb[i];
+			}
+			Fixed q;
+			for (int i = Width-1; i >= 0; i--) {
+				r <<= 1;
+				r.limb[0] |= (uint64_t)a.bit(i);
+				if (r >= d) {
+					r -= d;
+					q.limb[i/64] |= (uint64_t)1 << (i%64);
+				}
+			}
+			quotient = q;
+			for (int i = 0; i < limbs; i++) {
+				remainder.limb[i] = r.limb[i];
+			}
+		}
+	}
+};
+
+}
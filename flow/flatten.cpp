@@ -0,0 +1,140 @@
+#include "flatten.h"
+
+#include <unordered_map>
+
+#include <common/mapping.h>
+
+namespace flow {
+
+clocked::Module flattenGraph(const Graph &graph, const vector<clocked::Module> &mods, string name) {
+	clocked::Module top;
+	top.name = name;
+	top.clk = top.pushNet("clk", clocked::Type(clocked::Type::TypeName::BITS, 1), clocked::Net::Purpose::IN);
+	top.reset = top.pushNet("reset", clocked::Type(clocked::Type::TypeName::BITS, 1), clocked::Net::Purpose::IN);
+
+	// Net names of each Module, so arcs find their ports in constant time
+	vector<unordered_map<string, int> > names(mods.size());
+	for (size_t modIdx = 0; modIdx < mods.size(); modIdx++) {
+		for (int net = 0; net < (int)mods[modIdx].nets.size(); net++) {
+			names[modIdx].insert({mods[modIdx].nets[net].name, net});
+		}
+	}
+
+	// Nets of each node in top
+	vector<Mapping<size_t> > netMaps(graph.nodes.size(), Mapping<size_t>(-1, false));
+	vector<bool> placed(graph.nodes.size(), false);
+	int scanEnable = -1, scanOut = -1;
+	for (size_t node = 0; node < graph.nodes.size(); node++) {
+		int modIdx = graph.nodes[node];
+		if (modIdx < 0 or modIdx >= (int)mods.size()) {
+			continue;
+		}
+		const clocked::Module &mod = mods[modIdx];
+		string prefix = mod.name+"_"+::to_string(node)+"_";
+
+		placed[node] = true;
+		Mapping<size_t> &netMap = netMaps[node];
+		for (int net = 0; net < (int)mod.nets.size(); net++) {
+			if (net == mod.clk) {
+				netMap.set(net, top.clk);
+			} else if (net == mod.reset) {
+				netMap.set(net, top.reset);
+			} else {
+				netMap.set(net, top.pushNet(prefix+mod.nets[net].name, mod.nets[net].type, mod.nets[net].purpose));
+			}
+		}
+		auto remap = [&](Expression e) {
+			e.applyVars(netMap);
+			return e;
+		};
+		auto remapAssigns = [&](const vector<clocked::Assign> &assigns) {
+			vector<clocked::Assign> result;
+			for (auto assign = assigns.begin(); assign != assigns.end(); assign++) {
+				result.push_back(clocked::Assign(netMap.map(assign->net), remap(assign->expr), assign->blocking));
+			}
+			return result;
+		};
+		auto remapRules = [&](const vector<clocked::Rule> &rules) {
+			vector<clocked::Rule> result;
+			for (auto rule = rules.begin(); rule != rules.end(); rule++) {
+				result.push_back(clocked::Rule(remapAssigns(rule->assign), remap(rule->guard)));
+				result.back().isChained = rule->isChained;
+			}
+			return result;
+		};
+
+		vector<clocked::Assign> assigns = remapAssigns(mod.assign);
+		top.assign.insert(top.assign.end(), assigns.begin(), assigns.end());
+		for (auto block = mod.blocks.begin(); block != mod.blocks.end(); block++) {
+			top.blocks.push_back(clocked::Block(remap(block->clk), remapRules(block->rules)));
+			top.blocks.back().reset = remapAssigns(block->reset);
+			top.blocks.back()._else = remapRules(block->_else);
+		}
+
+		// One scan chain through every node's counters
+		auto scan = names[modIdx].find("perf_scan");
+		if (scan != names[modIdx].end()) {
+			int enable = (int)netMap.map(scan->second);
+			int in = (int)netMap.map(names[modIdx].at("perf_scan_in"));
+			int out = (int)netMap.map(names[modIdx].at("perf_scan_out"));
+			if (scanOut < 0) {
+				top.nets[enable].name = "perf_scan";
+				top.nets[in].name = "perf_scan_in";
+				scanEnable = enable;
+			} else {
+				top.nets[enable].purpose = clocked::Net::Purpose::WIRE;
+				top.nets[in].purpose = clocked::Net::Purpose::WIRE;
+				top.assign.push_back(clocked::Assign(enable, Expression::varOf(scanEnable), true));
+				top.assign.push_back(clocked::Assign(in, Expression::varOf(scanOut), true));
+				top.nets[scanOut].purpose = clocked::Net::Purpose::WIRE;
+			}
+			scanOut = out;
+		}
+	}
+	if (scanOut >= 0) {
+		top.nets[scanOut].name = "perf_scan_out";
+	}
+
+	// Connect the ports of every arc, channels are point to point
+	static const vector<string> suffixes = {"_valid", "_ready", "_data", "_credit"};
+	for (auto arc = graph.arcs.begin(); arc != graph.arcs.end(); arc++) {
+		if (arc->from < 0 or arc->from >= (int)graph.nodes.size() or not placed[arc->from]
+			or arc->to < 0 or arc->to >= (int)graph.nodes.size() or not placed[arc->to]) {
+			continue;
+		}
+		int fromMod = graph.nodes[arc->from];
+		int toMod = graph.nodes[arc->to];
+		const Func &producer = graph.funcs[fromMod];
+		const Func &consumer = graph.funcs[toMod];
+		if (arc->fromPort < 0 or arc->fromPort >= (int)producer.nets.size()
+			or arc->toPort < 0 or arc->toPort >= (int)consumer.nets.size()) {
+			continue;
+		}
+
+		for (auto suffix = suffixes.begin(); suffix != suffixes.end(); suffix++) {
+			auto from = names[fromMod].find(producer.nets[arc->fromPort].name+*suffix);
+			auto to = names[toMod].find(consumer.nets[arc->toPort].name+*suffix);
+			if (from == names[fromMod].end() or to == names[toMod].end()) {
+				continue;
+			}
+
+			int fromNet = (int)netMaps[arc->from].map(from->second);
+			int toNet = (int)netMaps[arc->to].map(to->second);
+			clocked::Net::Purpose fromPurpose = top.nets[fromNet].purpose;
+			clocked::Net::Purpose toPurpose = top.nets[toNet].purpose;
+			if (fromPurpose == clocked::Net::Purpose::OUT and toPurpose == clocked::Net::Purpose::IN) {
+				top.nets[fromNet].purpose = clocked::Net::Purpose::WIRE;
+				top.nets[toNet].purpose = clocked::Net::Purpose::WIRE;
+				top.assign.push_back(clocked::Assign(toNet, Expression::varOf(fromNet), true));
+			} else if (fromPurpose == clocked::Net::Purpose::IN and toPurpose == clocked::Net::Purpose::OUT) {
+				top.nets[fromNet].purpose = clocked::Net::Purpose::WIRE;
+				top.nets[toNet].purpose = clocked::Net::Purpose::WIRE;
+				top.assign.push_back(clocked::Assign(fromNet, Expression::varOf(toNet), true));
+			}
+		}
+	}
+
+	return top;
+}
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "graph.h"
+#include "module.h"
+
+namespace flow {
+
+// Inline the Module of every node of graph into a single top level Module.
+// mods is indexed like graph.funcs, so to synthesize each distinct Func
+// only once, flatten a copy of the Graph after dedupFuncs(). The nets of
+// each node are prefixed with its Module's name and node index, and every
+// node shares the top level clk and reset. Each arc connects the _valid,
+// _ready, _data, and _credit ports of its channel by name, the OUT side
+// driving the IN side, and the connected ports become wires. Ports left
+// unconnected stay ports of the top level Module. The perf_scan chains of
+// nodes with performance counters are strung together in node order. Runs
+// in time linear in the size of the Graph and its Modules.
+clocked::Module flattenGraph(const Graph &graph, const vector<clocked::Module> &mods, string name="top");
+
+}
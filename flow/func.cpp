@@ -1,7 +1,10 @@
 #include "func.h"
 
 #include <compare>
+#include <functional>
 #include <iostream>
+#include <set>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -38,11 +41,24 @@ Net::Net(string name, Type type, Purpose purpose) {
 	this->name = name;
 	this->type = type;
 	this->purpose = purpose;
+	this->buffering = Buffering::REGISTER;
+	this->depth = 1;
+	this->protocol = Protocol::VALID_READY;
+	this->credits = 2;
 }
 
 Net::~Net() {
 }
 
+int Net::queueDepth() const {
+	switch (buffering) {
+		case Buffering::SKID: return 2;
+		case Buffering::FIFO: return depth > 0 ? depth : 1;
+		case Buffering::REGISTER:
+		default: return 0;
+	}
+}
+
 std::ostream& operator<<(std::ostream& os, const Net& net) {
 		string purpose;
 		switch (net.purpose) {
@@ -265,6 +281,34 @@ int Func::pushCond(Expression valid) {
 	return index;
 }
 
+string Func::structuralKey() const {
+	std::ostringstream key;
+	for (auto net = nets.begin(); net != nets.end(); net++) {
+		key << net->name << ":" << net->type.type << ":" << net->type.width << ":"
+		    << net->type.shift << ":" << net->purpose << ":" << net->queueDepth() << ":"
+		    << net->protocol << ":" << net->credits << ";";
+	}
+	key << "|";
+	for (auto cond = conds.begin(); cond != conds.end(); cond++) {
+		key << cond->uid << "?" << cond->valid.to_string() << "{";
+		for (auto out = cond->outs.begin(); out != cond->outs.end(); out++) {
+			key << "o" << out->first << "=" << out->second.to_string() << ";";
+		}
+		for (auto reg = cond->regs.begin(); reg != cond->regs.end(); reg++) {
+			key << "r" << reg->first << "=" << reg->second.to_string() << ";";
+		}
+		for (auto in = cond->ins.begin(); in != cond->ins.end(); in++) {
+			key << "i" << *in << ";";
+		}
+		key << "}";
+	}
+	return key.str();
+}
+
+size_t Func::structuralHash() const {
+	return std::hash<string>()(structuralKey());
+}
+
 std::ostream& operator<<(std::ostream& os, const Func& func) {
 	os << "Func: " << func.name << "\n";
 
@@ -337,7 +381,10 @@ bool operator==(const Func &f1, const Func &f2) {
 
 		if (net1.name != net2.name ||
 				net1.type != net2.type ||
-				net1.purpose != net2.purpose) {
+				net1.purpose != net2.purpose ||
+				net1.queueDepth() != net2.queueDepth() ||
+				net1.protocol != net2.protocol ||
+				net1.credits != net2.credits) {
 			return false;
 		}
 	}
@@ -356,6 +403,16 @@ bool operator!=(const Func &f1, const Func &f2) {
 	return !(f1 == f2);
 }
 
+set<size_t> getNetsInExpression(const Expression &e) {
+	set<size_t> nets;
+	for (const arithmetic::Operand &operand : e.exprIndex()) {
+		if (operand.type == arithmetic::Operand::Type::VAR) {
+			nets.insert(operand.index);
+		}
+	}
+	return nets;
+}
+
 
 
 }
@@ -2,6 +2,7 @@
 
 #include <compare>
 #include <iostream>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -40,6 +41,26 @@ struct Net {
 		COND = 4,
 	};
 
+	// How the channel of an OUT net holds tokens. REGISTER is a single
+	// output register whose ready path is combinational. SKID and FIFO put
+	// a queue behind that register, two slots deep for SKID and depth slots
+	// for FIFO, whose ready only depends on registered state.
+	enum Buffering {
+		REGISTER = 0,
+		SKID = 1,
+		FIFO = 2,
+	};
+
+	// Handshake of the channel of an IN or OUT net. VALID_READY needs the
+	// receiver's ready in the same cycle. CREDIT has the sender count the
+	// free slots of the receiver, which returns a credit pulse per token it
+	// consumes, so the channel can cross any number of pipeline registers.
+	// Both ends of a CREDIT channel must declare the same number of credits.
+	enum Protocol {
+		VALID_READY = 0,
+		CREDIT = 1,
+	};
+
 	Net(string name="", Type type=Type(Type::TypeName::BITS, 1), Purpose purpose=Purpose::NONE);
 	~Net();
 
@@ -47,6 +68,15 @@ struct Net {
 	Type type;
 	Purpose purpose;
 
+	Buffering buffering;
+	int depth;
+
+	Protocol protocol;
+	int credits;
+
+	// Number of queue slots behind the output register, 0 for REGISTER
+	int queueDepth() const;
+
 	auto operator<=>(const Net &n) const = default;
 	bool operator==(const Net &n) const = default;
 	bool operator!=(const Net &n) const = default;
@@ -114,9 +144,17 @@ struct Func {
 
 	Operand pushNet(string name, Type type=Type(Type::TypeName::BITS, 1), Net::Purpose purpose=Net::Purpose::NONE);
 	int pushCond(Expression valid);
+
+	// Canonical form of everything but the Func's name. Funcs with equal
+	// keys synthesize to the same Module.
+	string structuralKey() const;
+	size_t structuralHash() const;
+
 	friend std::ostream& operator<<(std::ostream& os, const Func& f);
 };
 
 bool operator==(const Func &f1, const Func &f2);
 bool operator!=(const Func &f1, const Func &f2);
+
+set<size_t> getNetsInExpression(const Expression &e);
 }
@@ -1,8 +1,14 @@
 #include "graph.h"
 
+#include <unordered_map>
+
 namespace flow {
 
 Arc::Arc() {
+	from = -1;
+	fromPort = -1;
+	to = -1;
+	toPort = -1;
 }
 
 Arc::~Arc() {
@@ -14,4 +20,25 @@ Graph::Graph() {
 Graph::~Graph() {
 }
 
+int Graph::dedupFuncs() {
+	// compare full keys so a hash collision can't merge different Funcs
+	unordered_map<string, int> canon;
+	vector<int> funcMap(funcs.size(), -1);
+	vector<Func> unique;
+	for (size_t funcIdx = 0; funcIdx < funcs.size(); funcIdx++) {
+		auto result = canon.insert({funcs[funcIdx].structuralKey(), (int)unique.size()});
+		if (result.second) {
+			unique.push_back(funcs[funcIdx]);
+		}
+		funcMap[funcIdx] = result.first->second;
+	}
+
+	int removed = (int)(funcs.size() - unique.size());
+	funcs = unique;
+	for (auto node = nodes.begin(); node != nodes.end(); node++) {
+		*node = funcMap[*node];
+	}
+	return removed;
+}
+
 }
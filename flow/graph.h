@@ -18,8 +18,10 @@ struct Arc {
 	Arc();
 	~Arc();
 
+	// node and net index of the output in its Func, -1 if unconnected
 	int from;
 	int fromPort;
+	// node and net index of the input in its Func
 	int to;
 	int toPort;
 };
@@ -31,8 +33,14 @@ struct Graph {
 	vector<Func> funcs;
 	vector<Type> types;
 
+	// index into funcs for each instance
 	vector<int> nodes;
 	vector<Arc> arcs;
+
+	// Collapse structurally identical Funcs, ignoring their names, into the
+	// first of them and point every node at the survivor. Returns the number
+	// of Funcs removed.
+	int dedupFuncs();
 };
 
 }
@@ -0,0 +1,190 @@
+#include "index.h"
+
+#include <algorithm>
+
+namespace flow {
+
+GraphIndex::GraphIndex() {
+	nodes = 0;
+	graph = nullptr;
+	outOffset.assign(1, 0);
+	inOffset.assign(1, 0);
+}
+
+GraphIndex::GraphIndex(const Graph &graph) {
+	this->graph = &graph;
+	nodes = (int)graph.nodes.size();
+
+	// counting sort of the arcs by node, then by port within each node
+	auto build = [&](vector<int> &offset, vector<int> &arcs, bool out) {
+		offset.assign(nodes+1, 0);
+		for (auto arc = graph.arcs.begin(); arc != graph.arcs.end(); arc++) {
+			if (arc->from >= 0 and arc->from < nodes and arc->to >= 0 and arc->to < nodes) {
+				offset[(out ? arc->from : arc->to)+1]++;
+			}
+		}
+		for (int node = 0; node < nodes; node++) {
+			offset[node+1] += offset[node];
+		}
+
+		arcs.resize(offset[nodes]);
+		vector<int> fill(offset.begin(), offset.end()-1);
+		for (int arcIdx = 0; arcIdx < (int)graph.arcs.size(); arcIdx++) {
+			const Arc &arc = graph.arcs[arcIdx];
+			if (arc.from >= 0 and arc.from < nodes and arc.to >= 0 and arc.to < nodes) {
+				arcs[fill[out ? arc.from : arc.to]++] = arcIdx;
+			}
+		}
+
+		for (int node = 0; node < nodes; node++) {
+			std::stable_sort(arcs.begin()+offset[node], arcs.begin()+offset[node+1], [&](int a, int b) {
+				return out ? graph.arcs[a].fromPort < graph.arcs[b].fromPort : graph.arcs[a].toPort < graph.arcs[b].toPort;
+			});
+		}
+	};
+
+	build(outOffset, outArcs, true);
+	build(inOffset, inArcs, false);
+}
+
+GraphIndex::~GraphIndex() {
+}
+
+std::span<const int> GraphIndex::fanout(int node) const {
+	return std::span<const int>(outArcs.data()+outOffset[node], outOffset[node+1]-outOffset[node]);
+}
+
+std::span<const int> GraphIndex::fanin(int node) const {
+	return std::span<const int>(inArcs.data()+inOffset[node], inOffset[node+1]-inOffset[node]);
+}
+
+int GraphIndex::arcFrom(int node, int port) const {
+	if (node < 0 or node >= nodes) {
+		return -1;
+	}
+	std::span<const int> arcs = fanout(node);
+	auto arc = std::lower_bound(arcs.begin(), arcs.end(), port, [&](int a, int port) {
+		return graph->arcs[a].fromPort < port;
+	});
+	return (arc != arcs.end() and graph->arcs[*arc].fromPort == port) ? *arc : -1;
+}
+
+int GraphIndex::arcTo(int node, int port) const {
+	if (node < 0 or node >= nodes) {
+		return -1;
+	}
+	std::span<const int> arcs = fanin(node);
+	auto arc = std::lower_bound(arcs.begin(), arcs.end(), port, [&](int a, int port) {
+		return graph->arcs[a].toPort < port;
+	});
+	return (arc != arcs.end() and graph->arcs[*arc].toPort == port) ? *arc : -1;
+}
+
+vector<int> topologicalSort(const GraphIndex &index) {
+	vector<int> waiting(index.nodes, 0);
+	for (int node = 0; node < index.nodes; node++) {
+		waiting[node] = (int)index.fanin(node).size();
+	}
+
+	// the result doubles as the queue of ready nodes
+	vector<int> order;
+	order.reserve(index.nodes);
+	for (int node = 0; node < index.nodes; node++) {
+		if (waiting[node] == 0) {
+			order.push_back(node);
+		}
+	}
+	for (size_t i = 0; i < order.size(); i++) {
+		for (int arc : index.fanout(order[i])) {
+			int to = index.graph->arcs[arc].to;
+			if (--waiting[to] == 0) {
+				order.push_back(to);
+			}
+		}
+	}
+	return order;
+}
+
+int stronglyConnectedComponents(const GraphIndex &index, vector<int> &component) {
+	component.assign(index.nodes, -1);
+	vector<int> order(index.nodes, -1);
+	vector<int> low(index.nodes, 0);
+	vector<bool> onStack(index.nodes, false);
+	vector<int> stack;
+
+	// explicit call stack of nodes and the next arc to follow from each
+	vector<pair<int, int> > calls;
+	int visited = 0;
+	int count = 0;
+	for (int root = 0; root < index.nodes; root++) {
+		if (order[root] >= 0) {
+			continue;
+		}
+
+		calls.push_back({root, 0});
+		order[root] = low[root] = visited++;
+		stack.push_back(root);
+		onStack[root] = true;
+		while (not calls.empty()) {
+			int node = calls.back().first;
+			std::span<const int> arcs = index.fanout(node);
+			if (calls.back().second < (int)arcs.size()) {
+				int to = index.graph->arcs[arcs[calls.back().second++]].to;
+				if (order[to] < 0) {
+					calls.push_back({to, 0});
+					order[to] = low[to] = visited++;
+					stack.push_back(to);
+					onStack[to] = true;
+				} else if (onStack[to]) {
+					low[node] = std::min(low[node], order[to]);
+				}
+				continue;
+			}
+
+			calls.pop_back();
+			if (not calls.empty()) {
+				int parent = calls.back().first;
+				low[parent] = std::min(low[parent], low[node]);
+			}
+			if (low[node] == order[node]) {
+				int member;
+				do {
+					member = stack.back();
+					stack.pop_back();
+					onStack[member] = false;
+					component[member] = count;
+				} while (member != node);
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+vector<int> breadthFirstSearch(const GraphIndex &index, const vector<int> &roots, bool forward) {
+	vector<int> distance(index.nodes, -1);
+	vector<int> frontier, next;
+	for (auto root = roots.begin(); root != roots.end(); root++) {
+		if (*root >= 0 and *root < index.nodes and distance[*root] < 0) {
+			distance[*root] = 0;
+			frontier.push_back(*root);
+		}
+	}
+
+	for (int level = 1; not frontier.empty(); level++) {
+		next.clear();
+		for (auto node = frontier.begin(); node != frontier.end(); node++) {
+			for (int arc : forward ? index.fanout(*node) : index.fanin(*node)) {
+				int to = forward ? index.graph->arcs[arc].to : index.graph->arcs[arc].from;
+				if (distance[to] < 0) {
+					distance[to] = level;
+					next.push_back(to);
+				}
+			}
+		}
+		frontier.swap(next);
+	}
+	return distance;
+}
+
+}
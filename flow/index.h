@@ -0,0 +1,51 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "graph.h"
+
+namespace flow {
+
+// Fan-in and fan-out of every node of a Graph in compressed sparse row
+// form. The arcs leaving node n are outArcs[outOffset[n]] up to
+// outArcs[outOffset[n+1]], sorted by fromPort, and likewise for the arcs
+// entering it by toPort. Arcs with an endpoint outside the Graph are left
+// out. Build it once after the Graph is done changing.
+struct GraphIndex {
+	GraphIndex();
+	GraphIndex(const Graph &graph);
+	~GraphIndex();
+
+	int nodes;
+	const Graph *graph;
+
+	vector<int> outOffset;
+	vector<int> outArcs;
+	vector<int> inOffset;
+	vector<int> inArcs;
+
+	std::span<const int> fanout(int node) const;
+	std::span<const int> fanin(int node) const;
+
+	// Arc on the given port of node, -1 if it isn't connected
+	int arcFrom(int node, int port) const;
+	int arcTo(int node, int port) const;
+};
+
+// Nodes in topological order by Kahn's algorithm. Nodes on or behind a
+// cycle never become ready and are left out, so the result is shorter than
+// the Graph exactly when it has a cycle.
+vector<int> topologicalSort(const GraphIndex &index);
+
+// Tarjan's strongly connected components, without recursion. Sets the
+// component of every node and returns the number of components. Components
+// are numbered in reverse topological order, so arcs only ever go from a
+// component to one with a lower or equal number.
+int stronglyConnectedComponents(const GraphIndex &index, vector<int> &component);
+
+// Arcs from roots to every node in a breadth first search, following arcs
+// backwards if forward is false. -1 for nodes that can't be reached.
+vector<int> breadthFirstSearch(const GraphIndex &index, const vector<int> &roots, bool forward=true);
+
+}
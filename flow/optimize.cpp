@@ -0,0 +1,418 @@
+#include "optimize.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <arithmetic/algorithm.h>
+#include <common/mapping.h>
+
+using arithmetic::Operation;
+
+namespace flow {
+
+bool isUnsatisfiable(const Expression &e) {
+	Expression result(e);
+	result.minimize();
+	return areSame(result, Expression::boolOf(false))
+		or areSame(result, Expression::intOf(0));
+}
+
+int eliminateUnreachableConds(Func &func) {
+	int removed = 0;
+	for (auto cond = func.conds.begin(); cond != func.conds.end(); ) {
+		if (isUnsatisfiable(cond->valid)) {
+			cond = func.conds.erase(cond);
+			removed++;
+		} else {
+			cond++;
+		}
+	}
+	return removed;
+}
+
+bool areExclusive(const Expression &e0, const Expression &e1) {
+	return isUnsatisfiable(e0 && e1);
+}
+
+bool haveSameActions(const Condition &c0, const Condition &c1) {
+	auto byNet = [](const pair<int, Expression> &a, const pair<int, Expression> &b) {
+		return a.first < b.first;
+	};
+	auto sameWrites = [&](vector<pair<int, Expression> > w0, vector<pair<int, Expression> > w1) {
+		if (w0.size() != w1.size()) {
+			return false;
+		}
+		std::stable_sort(w0.begin(), w0.end(), byNet);
+		std::stable_sort(w1.begin(), w1.end(), byNet);
+		for (size_t i = 0; i < w0.size(); i++) {
+			if (w0[i].first != w1[i].first or not areSame(w0[i].second, w1[i].second)) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	set<int> ins0(c0.ins.begin(), c0.ins.end());
+	set<int> ins1(c1.ins.begin(), c1.ins.end());
+	return ins0 == ins1
+		and sameWrites(c0.outs, c1.outs)
+		and sameWrites(c0.regs, c1.regs);
+}
+
+int mergeConds(Func &func) {
+	int removed = 0;
+	for (size_t i = 0; i < func.conds.size(); i++) {
+		for (size_t j = i+1; j < func.conds.size(); ) {
+			bool canMerge = haveSameActions(func.conds[i], func.conds[j]);
+			for (size_t k = i+1; canMerge and k < j; k++) {
+				canMerge = areExclusive(func.conds[j].valid, func.conds[k].valid);
+			}
+
+			if (canMerge) {
+				func.conds[i].valid = func.conds[i].valid || func.conds[j].valid;
+				func.conds.erase(func.conds.begin()+j);
+				removed++;
+			} else {
+				j++;
+			}
+		}
+	}
+
+	return removed;
+}
+
+vector<int> prioritizeConds(const Func &func, const vector<int64_t> &profile) {
+	int n = (int)func.conds.size();
+	vector<int> order;
+	if (profile.empty()) {
+		for (int i = 0; i < n; i++) {
+			order.push_back(i);
+		}
+		return order;
+	}
+
+	auto count = [&](int cond) {
+		return cond < (int)profile.size() ? profile[cond] : (int64_t)0;
+	};
+
+	// Condition j has to wait on every earlier Condition it could fire
+	// alongside
+	vector<int> waiting(n, 0);
+	vector<vector<int> > after(n);
+	for (int i = 0; i < n; i++) {
+		for (int j = i+1; j < n; j++) {
+			if (not areExclusive(func.conds[i].valid, func.conds[j].valid)) {
+				after[i].push_back(j);
+				waiting[j]++;
+			}
+		}
+	}
+
+	// The hottest Condition that isn't waiting goes next, the first one on a tie
+	set<pair<int64_t, int> > ready;
+	for (int i = 0; i < n; i++) {
+		if (waiting[i] == 0) {
+			ready.insert({-count(i), i});
+		}
+	}
+
+	while (not ready.empty()) {
+		int i = ready.begin()->second;
+		ready.erase(ready.begin());
+		order.push_back(i);
+		for (auto j = after[i].begin(); j != after[i].end(); j++) {
+			if (--waiting[*j] == 0) {
+				ready.insert({-count(*j), *j});
+			}
+		}
+	}
+	return order;
+}
+
+vector<int> renumberNets(Func &func, const vector<bool> &keep) {
+	vector<int> netMap(func.nets.size(), -1);
+	Mapping<size_t> exprMap(-1, true);
+
+	vector<Net> nets;
+	for (size_t netIdx = 0; netIdx < func.nets.size(); netIdx++) {
+		if (keep[netIdx]) {
+			netMap[netIdx] = (int)nets.size();
+			exprMap.set(netIdx, nets.size());
+			nets.push_back(func.nets[netIdx]);
+		}
+	}
+	func.nets = nets;
+
+	for (size_t condIdx = 0; condIdx < func.conds.size(); condIdx++) {
+		Condition &cond = func.conds[condIdx];
+		cond.uid = netMap[cond.uid];
+		// keep branch names in step with their index like pushCond() does
+		if (cond.uid >= 0) {
+			func.nets[cond.uid].name = "branch_" + ::to_string(condIdx);
+		}
+
+		cond.valid.applyVars(exprMap);
+		for (auto out = cond.outs.begin(); out != cond.outs.end(); out++) {
+			out->first = netMap[out->first];
+			out->second.applyVars(exprMap);
+		}
+		for (auto reg = cond.regs.begin(); reg != cond.regs.end(); reg++) {
+			reg->first = netMap[reg->first];
+			reg->second.applyVars(exprMap);
+		}
+		for (auto in = cond.ins.begin(); in != cond.ins.end(); in++) {
+			*in = netMap[*in];
+		}
+	}
+
+	return netMap;
+}
+
+vector<int> eliminateDeadNets(Func &func) {
+	vector<bool> keep(func.nets.size(), false);
+	for (size_t netIdx = 0; netIdx < func.nets.size(); netIdx++) {
+		keep[netIdx] = (func.nets[netIdx].purpose == Net::Purpose::IN);
+	}
+
+	// Everything read by a guard, an output or an acknowledgement is live.
+	// Registers are only live once something live reads them, so values
+	// that only ever feed their own register drop out.
+	vector<size_t> worklist;
+	auto markLive = [&](size_t netIdx) {
+		if (netIdx < keep.size() and not keep[netIdx]) {
+			keep[netIdx] = true;
+			worklist.push_back(netIdx);
+		}
+	};
+
+	for (auto cond = func.conds.begin(); cond != func.conds.end(); cond++) {
+		markLive(cond->uid);
+		for (size_t net : getNetsInExpression(cond->valid)) {
+			markLive(net);
+		}
+		for (auto out = cond->outs.begin(); out != cond->outs.end(); out++) {
+			markLive(out->first);
+			for (size_t net : getNetsInExpression(out->second)) {
+				markLive(net);
+			}
+		}
+		for (auto in = cond->ins.begin(); in != cond->ins.end(); in++) {
+			markLive(*in);
+		}
+	}
+
+	while (not worklist.empty()) {
+		size_t netIdx = worklist.back();
+		worklist.pop_back();
+		if (func.nets[netIdx].purpose != Net::Purpose::REG) {
+			continue;
+		}
+
+		for (auto cond = func.conds.begin(); cond != func.conds.end(); cond++) {
+			for (auto reg = cond->regs.begin(); reg != cond->regs.end(); reg++) {
+				if (reg->first == (int)netIdx) {
+					for (size_t net : getNetsInExpression(reg->second)) {
+						markLive(net);
+					}
+				}
+			}
+		}
+	}
+
+	// Writes to dead registers go with them
+	for (auto cond = func.conds.begin(); cond != func.conds.end(); cond++) {
+		for (auto reg = cond->regs.begin(); reg != cond->regs.end(); ) {
+			if (not keep[reg->first]) {
+				reg = cond->regs.erase(reg);
+			} else {
+				reg++;
+			}
+		}
+	}
+
+	return renumberNets(func, keep);
+}
+
+vector<int> optimizeFunc(Func &func) {
+	eliminateUnreachableConds(func);
+	mergeConds(func);
+	return eliminateDeadNets(func);
+}
+
+// Base 2 log of a constant power of two, -1 for anything else
+int log2OfConst(const Operand &operand) {
+	if (not operand.isConst()) {
+		return -1;
+	}
+
+	int64_t value = 0;
+	if (operand.cnst.type == arithmetic::Value::INT) {
+		value = operand.cnst.ival;
+	} else if (operand.cnst.type == arithmetic::Value::REAL and operand.cnst.rval >= 1.0
+		and operand.cnst.rval < 4611686018427387904.0 and operand.cnst.rval == std::floor(operand.cnst.rval)) {
+		value = (int64_t)operand.cnst.rval;
+	}
+
+	if (value <= 0 or (value & (value-1)) != 0) {
+		return -1;
+	}
+	return std::countr_zero((uint64_t)value);
+}
+
+Expression reduceStrength(const Expression &e) {
+	Expression result = e;
+	if (not e.top.isExpr()) {
+		return result;
+	}
+
+	bool changed = false;
+	for (arithmetic::PostOrderDFSIterator operation_it(e.sub, {e.top}); !operation_it.done(); ++operation_it) {
+		const Operation &operation = *operation_it;
+		if (operation.operands.size() != 2) {
+			continue;
+		}
+
+		// multiply commutes, divide and mod only by a constant divisor
+		Operand x = operation.operands[0];
+		int k = log2OfConst(operation.operands[1]);
+		if (k < 0 and operation.func == Operation::OpType::MULTIPLY) {
+			x = operation.operands[1];
+			k = log2OfConst(operation.operands[0]);
+		}
+		if (k < 0) {
+			continue;
+		}
+
+		Operation reduced;
+		if (operation.func == Operation::OpType::MULTIPLY) {
+			reduced = k == 0 ? Operation(Operation::OpType::IDENTITY, {x})
+				: Operation(Operation::OpType::LEFT_SHIFT, {x, Operand::intOf(k)});
+		} else if (operation.func == Operation::OpType::DIVIDE) {
+			reduced = k == 0 ? Operation(Operation::OpType::IDENTITY, {x})
+				: Operation(Operation::OpType::RIGHT_SHIFT, {x, Operand::intOf(k)});
+		} else if (operation.func == Operation::OpType::MOD) {
+			reduced = k == 0 ? Operation(Operation::OpType::IDENTITY, {Operand::intOf(0)})
+				: Operation(Operation::OpType::BITWISE_AND, {x, Operand::intOf(((int64_t)1 << k) - 1)});
+		} else {
+			continue;
+		}
+
+		reduced.exprIndex = operation.exprIndex;
+		result.sub.setExpr(reduced);
+		changed = true;
+	}
+
+	if (changed) {
+		result.minimize();
+	}
+	return result;
+}
+
+void reduceStrength(Func &func) {
+	for (auto cond = func.conds.begin(); cond != func.conds.end(); cond++) {
+		cond->valid = reduceStrength(cond->valid);
+		for (auto out = cond->outs.begin(); out != cond->outs.end(); out++) {
+			out->second = reduceStrength(out->second);
+		}
+		for (auto reg = cond->regs.begin(); reg != cond->regs.end(); reg++) {
+			reg->second = reduceStrength(reg->second);
+		}
+	}
+}
+
+// Replace every read of net in e with net << k
+Expression shiftReads(const Expression &e, int net, int k) {
+	Expression result = e;
+	if (getNetsInExpression(e).count(net) == 0) {
+		return result;
+	}
+
+	Operand var = Operand::varOf(net);
+	Operand shifted = result.sub.pushExpr(Operation(Operation::OpType::LEFT_SHIFT, {var, Operand::intOf(k)}));
+
+	auto isRead = [&](const Operand &operand) {
+		return operand.isVar() and operand.index == (size_t)net;
+	};
+	if (isRead(e.top)) {
+		result.top = shifted;
+	} else if (e.top.isExpr()) {
+		for (arithmetic::PostOrderDFSIterator operation_it(e.sub, {e.top}); !operation_it.done(); ++operation_it) {
+			Operation operation = *operation_it;
+			bool changed = false;
+			for (auto operand = operation.operands.begin(); operand != operation.operands.end(); operand++) {
+				if (isRead(*operand)) {
+					*operand = shifted;
+					changed = true;
+				}
+			}
+			if (changed) {
+				result.sub.setExpr(operation);
+			}
+		}
+	}
+
+	result.minimize();
+	return result;
+}
+
+int foldRegisterShifts(Func &func) {
+	// Constant shift of every write to each REG, -1 if they don't agree
+	map<int, int> shifts;
+	for (auto cond = func.conds.begin(); cond != func.conds.end(); cond++) {
+		for (auto reg = cond->regs.begin(); reg != cond->regs.end(); reg++) {
+			Expression value = reg->second;
+			value.minimize();
+
+			int k = -1;
+			const Operation *top = value.top.isExpr() ? value.getExpr(value.top.index) : nullptr;
+			if (top != nullptr and top->func == Operation::OpType::LEFT_SHIFT and top->operands.size() == 2
+				and top->operands[1].isConst() and top->operands[1].cnst.type == arithmetic::Value::INT) {
+				k = (int)top->operands[1].cnst.ival;
+			}
+
+			auto shift = shifts.find(reg->first);
+			if (shift == shifts.end()) {
+				shifts.insert({reg->first, k});
+			} else if (shift->second != k) {
+				shift->second = -1;
+			}
+		}
+	}
+
+	int folded = 0;
+	for (auto shift = shifts.begin(); shift != shifts.end(); shift++) {
+		int net = shift->first;
+		int k = shift->second;
+		if (k <= 0 or func.nets[net].purpose != Net::Purpose::REG or func.nets[net].type.width <= k) {
+			continue;
+		}
+
+		for (auto cond = func.conds.begin(); cond != func.conds.end(); cond++) {
+			// unshift the writes, then shift every read including theirs
+			for (auto reg = cond->regs.begin(); reg != cond->regs.end(); reg++) {
+				if (reg->first == net) {
+					reg->second.minimize();
+					reg->second.top = reg->second.getExpr(reg->second.top.index)->operands[0];
+					reg->second.minimize();
+				}
+				reg->second = shiftReads(reg->second, net, k);
+			}
+			for (auto out = cond->outs.begin(); out != cond->outs.end(); out++) {
+				out->second = shiftReads(out->second, net, k);
+			}
+			cond->valid = shiftReads(cond->valid, net, k);
+		}
+
+		// the reads already scale it back, so type.shift stays as it was
+		func.nets[net].type.width -= k;
+		folded++;
+	}
+	return folded;
+}
+
+}
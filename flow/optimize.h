@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "func.h"
+
+namespace flow {
+
+// True if the expression minimizes to a constant false
+bool isUnsatisfiable(const Expression &e);
+
+// Drop every Condition whose guard can never be satisfied, returns the number
+// of Conditions removed. Their COND nets are left for eliminateDeadNets().
+int eliminateUnreachableConds(Func &func);
+
+// True if the two guards can never hold at the same time
+bool areExclusive(const Expression &e0, const Expression &e1);
+
+// True if both Conditions write the same outs and regs with structurally
+// equal expressions and acknowledge the same inputs. Guards are ignored.
+bool haveSameActions(const Condition &c0, const Condition &c1);
+
+// Merge Conditions with the same actions into one by OR-ing their guards.
+// A later Condition only moves up the priority chain past Conditions its
+// guard is exclusive with, so arbitration is unchanged. Returns the number
+// of Conditions removed. Their COND nets are left for eliminateDeadNets().
+int mergeConds(Func &func);
+
+// Order to check the Conditions in so the ones that fire most often come
+// first, given how many times each one fired in profile, indexed like
+// func.conds. A Condition only moves ahead of earlier Conditions its guard
+// is exclusive with, so arbitration is unchanged. Ties and Conditions
+// missing from profile keep their original order.
+std::vector<int> prioritizeConds(const Func &func, const std::vector<int64_t> &profile);
+
+// Keep only the nets marked in keep, renumbering the survivors densely in
+// their original order. Returns the old-to-new net mapping, -1 if removed.
+std::vector<int> renumberNets(Func &func, const std::vector<bool> &keep);
+
+// Remove REG nets that are never read, OUT nets that are never written, and
+// any other net no Condition references. IN nets are part of the Func's
+// interface and always kept. Returns the old-to-new net mapping.
+std::vector<int> eliminateDeadNets(Func &func);
+
+// Run all of the Func-level passes above. Returns the old-to-new net mapping.
+std::vector<int> optimizeFunc(Func &func);
+
+// Rewrite multiply, divide and mod by a constant power of two into left
+// shift, right shift and mask. Values are unsigned, so these are exact.
+Expression reduceStrength(const Expression &e);
+void reduceStrength(Func &func);
+
+// A REG whose every write is shifted left by the same constant only keeps
+// the bits above the shift. Store the unshifted value in a narrower net and
+// shift every read of it back with an explicit left shift. The net's
+// type.shift is left alone: emitters read a net's stored bits as its value
+// and never apply type.shift themselves. Returns the number of REG nets
+// folded.
+int foldRegisterShifts(Func &func);
+
+}
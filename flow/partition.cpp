@@ -0,0 +1,447 @@
+#include "partition.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <set>
+
+namespace flow {
+
+// Undirected graph in compressed sparse row form, parallel arcs merged into
+// one edge weighted by their count
+struct WeightedGraph {
+	vector<int> offset;
+	vector<int> adjacent;
+	vector<int> edgeWeight;
+	vector<int> nodeWeight;
+
+	int size() const {
+		return (int)nodeWeight.size();
+	}
+
+	int64_t totalWeight() const {
+		int64_t total = 0;
+		for (auto weight = nodeWeight.begin(); weight != nodeWeight.end(); weight++) {
+			total += *weight;
+		}
+		return total;
+	}
+};
+
+// Graph of nodeWeight.size() nodes from a list of edges, merging duplicates
+// and dropping self loops
+WeightedGraph buildWeightedGraph(const vector<int> &nodeWeight, vector<pair<int, int> > edges, const vector<int> &weights) {
+	WeightedGraph g;
+	g.nodeWeight = nodeWeight;
+	int n = g.size();
+
+	vector<vector<pair<int, int> > > lists(n);
+	for (size_t i = 0; i < edges.size(); i++) {
+		int u = edges[i].first, v = edges[i].second;
+		if (u != v) {
+			lists[u].push_back({v, weights[i]});
+			lists[v].push_back({u, weights[i]});
+		}
+	}
+
+	g.offset.assign(n+1, 0);
+	for (int u = 0; u < n; u++) {
+		std::sort(lists[u].begin(), lists[u].end());
+		for (auto edge = lists[u].begin(); edge != lists[u].end(); edge++) {
+			if (g.adjacent.size() > (size_t)g.offset[u] and g.adjacent.back() == edge->first) {
+				g.edgeWeight.back() += edge->second;
+			} else {
+				g.adjacent.push_back(edge->first);
+				g.edgeWeight.push_back(edge->second);
+			}
+		}
+		g.offset[u+1] = (int)g.adjacent.size();
+	}
+	return g;
+}
+
+// Match every node with the unmatched neighbor it shares the heaviest edge
+// with and collapse each pair into one node. Sets the coarse node of every
+// node in coarseOf.
+WeightedGraph coarsen(const WeightedGraph &g, vector<int> &coarseOf, int maxWeight) {
+	int n = g.size();
+	coarseOf.assign(n, -1);
+
+	// lightest nodes first so they don't get left out
+	vector<int> order(n);
+	for (int u = 0; u < n; u++) {
+		order[u] = u;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+		return g.nodeWeight[a] < g.nodeWeight[b];
+	});
+
+	int coarse = 0;
+	vector<int> coarseWeight;
+	for (auto it = order.begin(); it != order.end(); it++) {
+		int u = *it;
+		if (coarseOf[u] >= 0) {
+			continue;
+		}
+
+		int best = -1;
+		for (int e = g.offset[u]; e < g.offset[u+1]; e++) {
+			int v = g.adjacent[e];
+			if (coarseOf[v] < 0 and g.nodeWeight[u] + g.nodeWeight[v] <= maxWeight
+				and (best < 0 or g.edgeWeight[e] > g.edgeWeight[best])) {
+				best = e;
+			}
+		}
+
+		coarseOf[u] = coarse;
+		coarseWeight.push_back(g.nodeWeight[u]);
+		if (best >= 0) {
+			coarseOf[g.adjacent[best]] = coarse;
+			coarseWeight.back() += g.nodeWeight[g.adjacent[best]];
+		}
+		coarse++;
+	}
+
+	vector<pair<int, int> > edges;
+	vector<int> weights;
+	for (int u = 0; u < n; u++) {
+		for (int e = g.offset[u]; e < g.offset[u+1]; e++) {
+			int v = g.adjacent[e];
+			if (u < v and coarseOf[u] != coarseOf[v]) {
+				edges.push_back({coarseOf[u], coarseOf[v]});
+				weights.push_back(g.edgeWeight[e]);
+			}
+		}
+	}
+	return buildWeightedGraph(coarseWeight, edges, weights);
+}
+
+// Weight of the edges between the two sides
+int64_t cutWeight(const WeightedGraph &g, const vector<int> &side) {
+	int64_t cut = 0;
+	for (int u = 0; u < g.size(); u++) {
+		for (int e = g.offset[u]; e < g.offset[u+1]; e++) {
+			if (u < g.adjacent[e] and side[u] != side[g.adjacent[e]]) {
+				cut += g.edgeWeight[e];
+			}
+		}
+	}
+	return cut;
+}
+
+// Grow side 0 from seed, always taking the node that adds the least to the
+// cut, until it reaches its target weight
+vector<int> growBisection(const WeightedGraph &g, int seed, int64_t target) {
+	int n = g.size();
+	vector<int> side(n, 1);
+	// edges into side 0 less edges into side 1, for every node on side 1
+	vector<int64_t> gain(n, 0);
+	for (int u = 0; u < n; u++) {
+		for (int e = g.offset[u]; e < g.offset[u+1]; e++) {
+			gain[u] -= g.edgeWeight[e];
+		}
+	}
+
+	set<pair<int64_t, int> > frontier;
+	vector<bool> queued(n, false);
+	int64_t weight = 0;
+	int next = seed;
+	while (weight < target) {
+		if (next < 0) {
+			if (frontier.empty()) {
+				// disconnected, start again from any node left over
+				for (int u = 0; u < n and next < 0; u++) {
+					next = side[u] == 1 ? u : -1;
+				}
+				if (next < 0) {
+					break;
+				}
+			} else {
+				next = frontier.rbegin()->second;
+				frontier.erase(std::prev(frontier.end()));
+			}
+		}
+
+		int u = next;
+		next = -1;
+		if (side[u] == 0) {
+			continue;
+		}
+		if (queued[u]) {
+			frontier.erase({gain[u], u});
+		}
+		side[u] = 0;
+		weight += g.nodeWeight[u];
+		for (int e = g.offset[u]; e < g.offset[u+1]; e++) {
+			int v = g.adjacent[e];
+			if (side[v] == 1) {
+				if (queued[v]) {
+					frontier.erase({gain[v], v});
+				}
+				gain[v] += 2*g.edgeWeight[e];
+				frontier.insert({gain[v], v});
+				queued[v] = true;
+			}
+		}
+	}
+	return side;
+}
+
+// Fiduccia-Mattheyses passes, moving one node at a time to the other side
+// by best gain and keeping the best prefix of every pass. Like METIS, a
+// move may take a side over maxWeight by up to the heaviest node, or no
+// single move could ever leave a tight balance and come back; the best
+// prefix still prefers the least overflow.
+void refineBisection(const WeightedGraph &g, vector<int> &side, const int64_t maxWeight[2]) {
+	static const int MAX_PASSES = 8;
+	static const int MAX_IDLE_MOVES = 64;
+
+	int n = g.size();
+	int64_t weight[2] = {0, 0};
+	int64_t slack = 0;
+	for (int u = 0; u < n; u++) {
+		weight[side[u]] += g.nodeWeight[u];
+		slack = std::max(slack, (int64_t)g.nodeWeight[u]);
+	}
+
+	for (int pass = 0; pass < MAX_PASSES; pass++) {
+		// gain is the drop in cut from moving the node across
+		vector<int64_t> gain(n, 0);
+		set<pair<int64_t, int> > queue[2];
+		for (int u = 0; u < n; u++) {
+			for (int e = g.offset[u]; e < g.offset[u+1]; e++) {
+				gain[u] += side[g.adjacent[e]] != side[u] ? g.edgeWeight[e] : -g.edgeWeight[e];
+			}
+			queue[side[u]].insert({gain[u], u});
+		}
+
+		auto overflow = [&]() {
+			return std::max(weight[0] - maxWeight[0], (int64_t)0) + std::max(weight[1] - maxWeight[1], (int64_t)0);
+		};
+
+		vector<int> moves;
+		vector<bool> moved(n, false);
+		int64_t cut = 0, bestCut = 0, bestOverflow = overflow();
+		size_t best = 0;
+		while (moves.size() - best < MAX_IDLE_MOVES) {
+			// the best move that stays within the slack or doesn't make the
+			// balance worse
+			int u = -1;
+			for (int from = 0; from < 2; from++) {
+				if (queue[from].empty()) {
+					continue;
+				}
+				int v = queue[from].rbegin()->second;
+				int64_t after = std::max(weight[1-from] + g.nodeWeight[v] - maxWeight[1-from], (int64_t)0)
+				              + std::max(weight[from] - g.nodeWeight[v] - maxWeight[from], (int64_t)0);
+				bool allowed = weight[1-from] + g.nodeWeight[v] <= maxWeight[1-from] + slack or after <= overflow();
+				if (allowed and (u < 0 or gain[v] > gain[u])) {
+					u = v;
+				}
+			}
+			if (u < 0) {
+				break;
+			}
+
+			int from = side[u];
+			queue[from].erase({gain[u], u});
+			moved[u] = true;
+			moves.push_back(u);
+			side[u] = 1-from;
+			weight[from] -= g.nodeWeight[u];
+			weight[1-from] += g.nodeWeight[u];
+			cut -= gain[u];
+			for (int e = g.offset[u]; e < g.offset[u+1]; e++) {
+				int v = g.adjacent[e];
+				if (moved[v]) {
+					continue;
+				}
+				queue[side[v]].erase({gain[v], v});
+				gain[v] += side[v] == from ? 2*g.edgeWeight[e] : -2*g.edgeWeight[e];
+				queue[side[v]].insert({gain[v], v});
+			}
+
+			int64_t over = overflow();
+			if (over < bestOverflow or (over == bestOverflow and cut < bestCut)) {
+				bestCut = cut;
+				bestOverflow = over;
+				best = moves.size();
+			}
+		}
+
+		// undo everything past the best prefix
+		while (moves.size() > best) {
+			int u = moves.back();
+			moves.pop_back();
+			weight[side[u]] -= g.nodeWeight[u];
+			side[u] = 1-side[u];
+			weight[side[u]] += g.nodeWeight[u];
+		}
+		if (best == 0) {
+			break;
+		}
+	}
+}
+
+// Split g in two with fraction of the weight on side 0
+vector<int> bisect(const WeightedGraph &g, double fraction, double imbalance) {
+	static const int COARSEST = 64;
+	static const int SEEDS = 4;
+
+	int64_t total = g.totalWeight();
+	int64_t target = (int64_t)(fraction*(double)total + 0.5);
+	int64_t maxWeight[2] = {
+		std::max((int64_t)(imbalance*(double)target), target),
+		std::max((int64_t)(imbalance*(double)(total-target)), total-target),
+	};
+
+	// coarsen until the graph stops shrinking
+	vector<WeightedGraph> levels(1, g);
+	vector<vector<int> > coarseOf;
+	int maxNode = (int)std::max(std::min(maxWeight[0], maxWeight[1])/4, (int64_t)1);
+	while (levels.back().size() > COARSEST) {
+		vector<int> map;
+		WeightedGraph coarse = coarsen(levels.back(), map, maxNode);
+		if (coarse.size()*10 > levels.back().size()*9) {
+			break;
+		}
+		coarseOf.push_back(map);
+		levels.push_back(coarse);
+	}
+
+	// grow from a few seeds spread over the coarsest graph, keep the best
+	const WeightedGraph &coarsest = levels.back();
+	vector<int> side;
+	int64_t bestCut = -1;
+	for (int s = 0; s < SEEDS and s < coarsest.size(); s++) {
+		vector<int> candidate = growBisection(coarsest, (int)((int64_t)s*coarsest.size()/SEEDS), target);
+		refineBisection(coarsest, candidate, maxWeight);
+		int64_t cut = cutWeight(coarsest, candidate);
+		if (bestCut < 0 or cut < bestCut) {
+			bestCut = cut;
+			side = candidate;
+		}
+	}
+	if (side.empty()) {
+		side.assign(coarsest.size(), 0);
+	}
+
+	// project back up, refining at every level
+	for (int level = (int)coarseOf.size()-1; level >= 0; level--) {
+		vector<int> fine(levels[level].size());
+		for (int u = 0; u < (int)fine.size(); u++) {
+			fine[u] = side[coarseOf[level][u]];
+		}
+		side = fine;
+		refineBisection(levels[level], side, maxWeight);
+	}
+	return side;
+}
+
+// Partition g into parts, numbering them from first
+void partitionRecursive(const WeightedGraph &g, const vector<int> &nodes, int parts, int first, double imbalance, vector<int> &result) {
+	if (parts <= 1 or g.size() <= 1) {
+		for (auto node = nodes.begin(); node != nodes.end(); node++) {
+			result[*node] = first;
+		}
+		return;
+	}
+
+	int left = parts/2;
+	vector<int> side = bisect(g, (double)left/(double)parts, imbalance);
+
+	for (int s = 0; s < 2; s++) {
+		vector<int> local(g.size(), -1);
+		vector<int> subNodes, subWeight;
+		for (int u = 0; u < g.size(); u++) {
+			if (side[u] == s) {
+				local[u] = (int)subNodes.size();
+				subNodes.push_back(nodes[u]);
+				subWeight.push_back(g.nodeWeight[u]);
+			}
+		}
+
+		vector<pair<int, int> > edges;
+		vector<int> weights;
+		for (int u = 0; u < g.size(); u++) {
+			for (int e = g.offset[u]; e < g.offset[u+1]; e++) {
+				int v = g.adjacent[e];
+				if (u < v and local[u] >= 0 and local[v] >= 0) {
+					edges.push_back({local[u], local[v]});
+					weights.push_back(g.edgeWeight[e]);
+				}
+			}
+		}
+
+		partitionRecursive(buildWeightedGraph(subWeight, edges, weights), subNodes,
+			s == 0 ? left : parts-left, s == 0 ? first : first+left, imbalance, result);
+	}
+}
+
+vector<int> nodeCosts(const Graph &graph, NodeCost cost) {
+	vector<int> funcCost;
+	for (auto func = graph.funcs.begin(); func != graph.funcs.end(); func++) {
+		int total = 0;
+		for (auto cond = func->conds.begin(); cond != func->conds.end(); cond++) {
+			if (cost == NodeCost::CONDITIONS) {
+				total++;
+				continue;
+			}
+			total += (int)cond->valid.size();
+			for (auto reg = cond->regs.begin(); reg != cond->regs.end(); reg++) {
+				total += (int)reg->second.size();
+			}
+			for (auto out = cond->outs.begin(); out != cond->outs.end(); out++) {
+				total += (int)out->second.size();
+			}
+		}
+		funcCost.push_back(std::max(total, 1));
+	}
+
+	vector<int> costs;
+	for (auto node = graph.nodes.begin(); node != graph.nodes.end(); node++) {
+		costs.push_back(*node >= 0 and *node < (int)funcCost.size() ? funcCost[*node] : 1);
+	}
+	return costs;
+}
+
+vector<int> partitionGraph(const Graph &graph, int parts, const vector<int> &weights, double imbalance) {
+	vector<int> nodeWeight = weights.size() == graph.nodes.size() ? weights : nodeCosts(graph);
+	for (auto weight = nodeWeight.begin(); weight != nodeWeight.end(); weight++) {
+		*weight = std::max(*weight, 1);
+	}
+
+	vector<pair<int, int> > edges;
+	for (auto arc = graph.arcs.begin(); arc != graph.arcs.end(); arc++) {
+		if (arc->from >= 0 and arc->from < (int)graph.nodes.size() and arc->to >= 0 and arc->to < (int)graph.nodes.size()) {
+			edges.push_back({arc->from, arc->to});
+		}
+	}
+
+	vector<int> nodes(graph.nodes.size());
+	for (int node = 0; node < (int)nodes.size(); node++) {
+		nodes[node] = node;
+	}
+
+	// the imbalance of every bisection compounds down the levels
+	parts = std::max(parts, 1);
+	int levels = std::max((int)std::bit_width((unsigned)parts-1), 1);
+	double perLevel = std::pow(std::max(imbalance, 1.0), 1.0/(double)levels);
+
+	vector<int> part(graph.nodes.size(), 0);
+	partitionRecursive(buildWeightedGraph(nodeWeight, edges, vector<int>(edges.size(), 1)), nodes, parts, 0, perLevel, part);
+	return part;
+}
+
+int countCutArcs(const Graph &graph, const vector<int> &part) {
+	int cut = 0;
+	for (auto arc = graph.arcs.begin(); arc != graph.arcs.end(); arc++) {
+		if (arc->from >= 0 and arc->from < (int)part.size() and arc->to >= 0 and arc->to < (int)part.size()
+			and part[arc->from] != part[arc->to]) {
+			cut++;
+		}
+	}
+	return cut;
+}
+
+}
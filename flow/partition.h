@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+#include "graph.h"
+
+namespace flow {
+
+// What a node costs when balancing partitions
+enum class NodeCost {
+	CONDITIONS,
+	EXPRESSIONS,
+};
+
+// Cost of every node of graph, at least 1. CONDITIONS counts the
+// Conditions of its Func, EXPRESSIONS the operations in all of their guards
+// and writes.
+vector<int> nodeCosts(const Graph &graph, NodeCost cost=NodeCost::EXPRESSIONS);
+
+// Split the nodes of graph into parts with few arcs between them and a
+// total weight of at most imbalance times the average in each. weights
+// gives the cost of each node, like the measured time to simulate it, and
+// defaults to nodeCosts(). Multilevel recursive bisection in the style of
+// METIS: each bisection coarsens the graph by heavy edge matching, splits
+// the coarsest graph by greedy growing, and refines the split with
+// Fiduccia-Mattheyses passes on the way back up. Returns the part of every
+// node, numbered from 0.
+vector<int> partitionGraph(const Graph &graph, int parts, const vector<int> &weights=vector<int>(), double imbalance=1.05);
+
+// Number of arcs between nodes in different parts
+int countCutArcs(const Graph &graph, const vector<int> &part);
+
+}
@@ -0,0 +1,135 @@
+#include "pipeline.h"
+
+#include <algorithm>
+#include <map>
+
+#include <arithmetic/algorithm.h>
+
+using arithmetic::Operand;
+using arithmetic::Operation;
+
+namespace flow {
+
+// Operators between the nets of e and each of its operations, by exprIndex
+map<size_t, int> operationLevels(const Expression &e) {
+	map<size_t, int> levels;
+	if (not e.top.isExpr()) {
+		return levels;
+	}
+
+	for (arithmetic::PostOrderDFSIterator operation_it(e.sub, {e.top}); !operation_it.done(); ++operation_it) {
+		const Operation &operation = *operation_it;
+		int level = 0;
+		for (auto operand = operation.operands.begin(); operand != operation.operands.end(); operand++) {
+			auto operandLevel = operand->isExpr() ? levels.find(operand->index) : levels.end();
+			if (operandLevel != levels.end()) {
+				level = std::max(level, operandLevel->second);
+			}
+		}
+		levels[operation.exprIndex] = level + (operation.func == Operation::OpType::IDENTITY ? 0 : 1);
+	}
+	return levels;
+}
+
+int pipelineStages(const Expression &e, int depth) {
+	if (depth <= 0 or not e.top.isExpr()) {
+		return 0;
+	}
+
+	map<size_t, int> levels = operationLevels(e);
+	auto top = levels.find(e.top.index);
+	return top != levels.end() ? (top->second + depth - 1)/depth : 0;
+}
+
+vector<vector<Expression> > pipelineExpression(const Expression &e, int depth, int stages) {
+	depth = std::max(depth, 1);
+	stages = std::max(std::max(stages, pipelineStages(e, depth)), 1);
+
+	// Each operation is evaluated in the stage its level falls in, counting
+	// from 1. Nets are there from the start.
+	vector<Operation> operations;
+	map<size_t, int> stageOf;
+	if (e.top.isExpr()) {
+		map<size_t, int> levels = operationLevels(e);
+		for (arithmetic::PostOrderDFSIterator operation_it(e.sub, {e.top}); !operation_it.done(); ++operation_it) {
+			operations.push_back(*operation_it);
+			stageOf[operation_it->exprIndex] = (levels[operation_it->exprIndex] + depth - 1)/depth;
+		}
+	}
+	auto stageOfOperand = [&](const Operand &operand) {
+		return operand.isExpr() ? stageOf[operand.index] : 0;
+	};
+
+	// A value is held after stage s, for s from 0 to stages-2, if it is
+	// ready by then and something in a later stage still needs it
+	typedef pair<int, size_t> Key;
+	vector<map<Key, int> > held(stages-1);
+	vector<vector<Operand> > order(stages-1);
+	auto hold = [&](const Operand &operand, int until) {
+		for (int s = std::max(stageOfOperand(operand), 1)-1; s < until and s < stages-1; s++) {
+			Key key(operand.type, operand.index);
+			if (held[s].find(key) == held[s].end()) {
+				held[s].insert({key, (int)order[s].size()});
+				order[s].push_back(operand);
+			}
+		}
+	};
+	for (auto operation = operations.begin(); operation != operations.end(); operation++) {
+		for (auto operand = operation->operands.begin(); operand != operation->operands.end(); operand++) {
+			if (not operand->isConst()) {
+				hold(*operand, stageOf[operation->exprIndex]-1);
+			}
+		}
+	}
+	if (not e.top.isConst()) {
+		hold(e.top, stages-1);
+	}
+
+	// Computes value in stage s, reading from the values held after s-1
+	auto evaluate = [&](const Operand &value, int s) {
+		auto previous = [&](const Operand &operand) {
+			return Expression::varOf(held[s-1].at(Key(operand.type, operand.index)));
+		};
+
+		if (value.isConst()) {
+			return Expression(value);
+		} else if (s > 0 and stageOfOperand(value) <= s) {
+			return previous(value);
+		} else if (value.isVar()) {
+			return Expression(value);
+		}
+
+		Expression result = e;
+		for (auto operation = operations.begin(); s > 0 and operation != operations.end(); operation++) {
+			if (stageOf[operation->exprIndex] != s+1) {
+				continue;
+			}
+
+			Operation cut = *operation;
+			bool changed = false;
+			for (auto operand = cut.operands.begin(); operand != cut.operands.end(); operand++) {
+				if (not operand->isConst() and stageOfOperand(*operand) <= s) {
+					*operand = previous(*operand).top;
+					changed = true;
+				}
+			}
+			if (changed) {
+				result.sub.setExpr(cut);
+			}
+		}
+		result.top = value;
+		result.minimize();
+		return result;
+	};
+
+	vector<vector<Expression> > result(stages);
+	for (int s = 0; s < stages-1; s++) {
+		for (auto value = order[s].begin(); value != order[s].end(); value++) {
+			result[s].push_back(evaluate(*value, s));
+		}
+	}
+	result.back().push_back(evaluate(e.top, stages-1));
+	return result;
+}
+
+}
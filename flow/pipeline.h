@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+
+#include <arithmetic/expression.h>
+
+using arithmetic::Expression;
+
+namespace flow {
+
+// Number of stages needed to evaluate e with at most depth operators
+// between registers, 0 if e is a constant or a single net. Identities are
+// free.
+int pipelineStages(const Expression &e, int depth);
+
+// Cut e into stages of at most depth operators, padded out to the given
+// number of stages by carrying the result along. Stage i holds a list of
+// values, each with the expression that computes it. Stage 0 reads the
+// nets of e and every later stage reads the values of the stage before it,
+// as vars indexed by their position in that stage. The last stage holds the
+// one value of e.
+std::vector<std::vector<Expression> > pipelineExpression(const Expression &e, int depth, int stages);
+
+}
@@ -0,0 +1,559 @@
+#include "simulate.h"
+
+#include <algorithm>
+#include <bit>
+#include <map>
+
+#include <arithmetic/algorithm.h>
+
+#include "func.h"
+
+using arithmetic::Operation;
+
+namespace clocked {
+
+// Lanes are run a chunk at a time, so the slots the program touches stay
+// in cache from one Instruction to the next
+static const int CHUNK = 256;
+
+Instruction::Instruction(Op op, int dst, int a, int b, int c, uint64_t mask) {
+	this->op = op;
+	this->dst = dst;
+	this->a = a;
+	this->b = b;
+	this->c = c;
+	this->mask = mask;
+}
+
+Instruction::~Instruction() {
+}
+
+uint64_t maskOf(int width) {
+	return width >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << width) - 1;
+}
+
+uint64_t valueOf(const Operand &operand) {
+	const arithmetic::Value &value = operand.cnst;
+	if (value.type == arithmetic::Value::INT) {
+		return (uint64_t)value.ival;
+	} else if (value.type == arithmetic::Value::REAL) {
+		return value.rval >= 0.0 and value.rval < 18446744073709551616.0 ? (uint64_t)value.rval : 0;
+	} else if (value.type == arithmetic::Value::BOOL) {
+		return areSame(Expression(operand), Expression::boolOf(true)) ? 1 : 0;
+	} else if (value.type == arithmetic::Value::NEUTRAL) {
+		return 1;
+	}
+	return 0;
+}
+
+// Temporaries are numbered from here until the number of constants, and
+// so where they start, is known
+static const int TEMP = 1 << 30;
+
+// Compiles the expressions of a Module into Instructions
+struct Compiler {
+	BatchSimulator &sim;
+	int constBase;
+	map<uint64_t, int> constants;
+	vector<uint64_t> constValues;
+	int temps;
+	int maxTemps;
+
+	Compiler(BatchSimulator &sim, int constBase) : sim(sim), constBase(constBase), temps(0), maxTemps(0) {
+	}
+
+	int constant(uint64_t value) {
+		auto slot = constants.insert({value, constBase + (int)constants.size()});
+		if (slot.second) {
+			constValues.push_back(value);
+		}
+		return slot.first->second;
+	}
+
+	bool isConstant(int slot) const {
+		return slot >= constBase and slot < constBase + (int)constValues.size();
+	}
+
+	// Temporaries only live until the next call to expression()
+	int temp() {
+		maxTemps = std::max(maxTemps, ++temps);
+		return TEMP + temps - 1;
+	}
+
+	int widthOf(int net) {
+		return (int)std::bit_width(sim.mask[net]);
+	}
+
+	pair<int, int> compileOperation(int func, const vector<pair<int, int> > &args, vector<Instruction> &program) {
+		static const map<int, Instruction::Op> binary = {
+			{Operation::OpType::BITWISE_AND, Instruction::AND},
+			{Operation::OpType::BITWISE_OR, Instruction::OR},
+			{Operation::OpType::BITWISE_XOR, Instruction::XOR},
+			{Operation::OpType::BOOLEAN_AND, Instruction::LAND},
+			{Operation::OpType::BOOLEAN_OR, Instruction::LOR},
+			{Operation::OpType::BOOLEAN_XOR, Instruction::LXOR},
+			{Operation::OpType::EQUAL, Instruction::EQ},
+			{Operation::OpType::NOT_EQUAL, Instruction::NE},
+			{Operation::OpType::LESS, Instruction::LT},
+			{Operation::OpType::GREATER, Instruction::GT},
+			{Operation::OpType::LESS_EQUAL, Instruction::LE},
+			{Operation::OpType::GREATER_EQUAL, Instruction::GE},
+			{Operation::OpType::LEFT_SHIFT, Instruction::SHL},
+			{Operation::OpType::RIGHT_SHIFT, Instruction::SHR},
+			{Operation::OpType::ADD, Instruction::ADD},
+			{Operation::OpType::SUBTRACT, Instruction::SUB},
+			{Operation::OpType::MULTIPLY, Instruction::MUL},
+			{Operation::OpType::DIVIDE, Instruction::DIV},
+			{Operation::OpType::MOD, Instruction::MOD},
+		};
+
+		if (args.empty()) {
+			sim.errors.push_back("operation " + ::to_string(func) + " has no operands");
+			return {constant(0), 1};
+		}
+
+		auto unary = [&](Instruction::Op op, int width) {
+			int dst = temp();
+			program.push_back(Instruction(op, dst, args[0].first, -1, -1, maskOf(width)));
+			return pair<int, int>(dst, width);
+		};
+
+		switch (func) {
+			case Operation::OpType::IDENTITY:
+				return args[0];
+			case Operation::OpType::VALIDITY:
+				return {constant(1), 1};
+			case Operation::OpType::BITWISE_NOT:
+				return unary(Instruction::NOT, args[0].second);
+			case Operation::OpType::NEGATION:
+			case Operation::OpType::NEGATIVE:
+				return unary(Instruction::NEG, args[0].second);
+			case Operation::OpType::BOOLEAN_NOT:
+				return unary(Instruction::LNOT, 1);
+			case Operation::OpType::TERNARY:
+				if (args.size() == 3) {
+					int width = std::max(args[1].second, args[2].second);
+					int dst = temp();
+					program.push_back(Instruction(Instruction::SELECT, dst, args[0].first, args[1].first, args[2].first, maskOf(width)));
+					return {dst, width};
+				}
+				break;
+			default:
+				break;
+		}
+
+		auto op = binary.find(func);
+		if (op == binary.end() or args.size() < 2) {
+			sim.errors.push_back("operation " + ::to_string(func) + " is not supported");
+			return {constant(0), 1};
+		}
+
+		// operators over more than two operands fold from the left
+		pair<int, int> result = args[0];
+		for (size_t i = 1; i < args.size(); i++) {
+			int a = result.second, b = args[i].second;
+			int width = 1;
+			switch (op->second) {
+				case Instruction::AND:
+				case Instruction::OR:
+				case Instruction::XOR:
+				case Instruction::SUB:
+					width = std::max(a, b);
+					break;
+				case Instruction::ADD:
+					width = std::max(a, b) + 1;
+					break;
+				case Instruction::MUL:
+					width = a + b;
+					break;
+				case Instruction::DIV:
+				case Instruction::MOD:
+				case Instruction::SHR:
+					width = a;
+					break;
+				case Instruction::SHL:
+					width = 64;
+					if (isConstant(args[i].first) and constValues[args[i].first - constBase] < 64) {
+						width = a + (int)constValues[args[i].first - constBase];
+					}
+					break;
+				default:
+					break;
+			}
+			width = std::min(width, 64);
+
+			int dst = temp();
+			program.push_back(Instruction(op->second, dst, result.first, args[i].first, -1, maskOf(width)));
+			result = {dst, width};
+		}
+		return result;
+	}
+
+	// Slot and width of the value of e
+	pair<int, int> expression(const Expression &e, vector<Instruction> &program) {
+		temps = 0;
+		map<size_t, pair<int, int> > exprs;
+		auto operandOf = [&](const Operand &operand) {
+			if (operand.isConst()) {
+				uint64_t value = valueOf(operand);
+				return pair<int, int>(constant(value), std::max((int)std::bit_width(value), 1));
+			} else if (operand.isVar() and operand.index < sim.mask.size()) {
+				return pair<int, int>((int)operand.index, widthOf((int)operand.index));
+			} else if (operand.isExpr()) {
+				auto expr = exprs.find(operand.index);
+				if (expr != exprs.end()) {
+					return expr->second;
+				}
+			}
+			sim.errors.push_back("undefined operand");
+			return pair<int, int>(constant(0), 1);
+		};
+
+		if (not e.top.isExpr()) {
+			return operandOf(e.top);
+		}
+
+		for (arithmetic::PostOrderDFSIterator operation_it(e.sub, {e.top}); !operation_it.done(); ++operation_it) {
+			const Operation &operation = *operation_it;
+			vector<pair<int, int> > args;
+			for (auto operand = operation.operands.begin(); operand != operation.operands.end(); operand++) {
+				args.push_back(operandOf(*operand));
+			}
+			exprs[operation.exprIndex] = compileOperation(operation.func, args, program);
+		}
+		return operandOf(e.top);
+	}
+
+	// Write value into net, or have the Instruction that computed it write
+	// there directly
+	void store(int net, pair<int, int> value, vector<Instruction> &program) {
+		if (value.first >= TEMP and not program.empty() and program.back().dst == value.first
+			and program.back().a != net and program.back().b != net and program.back().c != net) {
+			program.back().dst = net;
+			program.back().mask &= sim.mask[net];
+		} else {
+			program.push_back(Instruction(Instruction::COPY, net, value.first, -1, -1, sim.mask[net]));
+		}
+	}
+};
+
+BatchSimulator::BatchSimulator() {
+	mod = nullptr;
+	lanes = 0;
+	stride = 0;
+	slots = 0;
+}
+
+BatchSimulator::BatchSimulator(const Module &mod, int lanes) {
+	this->mod = nullptr;
+	this->lanes = 0;
+	stride = 0;
+	slots = 0;
+
+	int nets = (int)mod.nets.size();
+	for (int net = 0; net < nets; net++) {
+		int width = mod.nets[net].type.width;
+		if (width > 64) {
+			errors.push_back(mod.nets[net].name + " is " + ::to_string(width) + " bits wide");
+		}
+		mask.push_back(maskOf(std::max(width, 1)));
+	}
+	if (not errors.empty()) {
+		mask.clear();
+		return;
+	}
+
+	this->mod = &mod;
+	this->lanes = std::max(lanes, 1);
+
+	// Next state of every register the Blocks write
+	vector<int> next(nets, -1);
+	int slotCount = nets;
+	auto written = [&](const vector<Assign> &assigns) {
+		for (auto assign = assigns.begin(); assign != assigns.end(); assign++) {
+			if (assign->net >= 0 and assign->net < nets and next[assign->net] < 0) {
+				next[assign->net] = slotCount++;
+				registers.push_back({assign->net, next[assign->net]});
+			}
+		}
+	};
+	for (auto block = mod.blocks.begin(); block != mod.blocks.end(); block++) {
+		written(block->reset);
+		for (const vector<Rule> *rules : {&block->rules, &block->_else}) {
+			for (auto rule = rules->begin(); rule != rules->end(); rule++) {
+				written(rule->assign);
+			}
+		}
+	}
+
+	// Fire masks of the Block being clocked
+	int notReset = slotCount++;
+	int any = slotCount++;
+	int taken = slotCount++;
+	int fire = slotCount++;
+	int otherwise = slotCount++;
+
+	Compiler compiler(*this, slotCount);
+	auto netName = [&](int net) {
+		return net >= 0 and net < nets ? mod.nets[net].name : ::to_string(net);
+	};
+
+	// Continuous assigns in dependency order, see analyzeTiming()
+	vector<int> driver(nets, -1);
+	vector<vector<int> > readers(nets);
+	vector<int> waiting(mod.assign.size(), 0);
+	for (int i = 0; i < (int)mod.assign.size(); i++) {
+		int net = mod.assign[i].net;
+		if (net >= 0 and net < nets) {
+			driver[net] = i;
+		} else {
+			errors.push_back("assign to undefined net " + netName(net));
+		}
+	}
+	for (int i = 0; i < (int)mod.assign.size(); i++) {
+		for (size_t net : flow::getNetsInExpression(mod.assign[i].expr)) {
+			if (net < (size_t)nets and driver[net] >= 0) {
+				readers[net].push_back(i);
+				waiting[i]++;
+			}
+		}
+	}
+
+	vector<int> order;
+	for (int i = 0; i < (int)mod.assign.size(); i++) {
+		if (waiting[i] == 0) {
+			order.push_back(i);
+		}
+	}
+	for (size_t k = 0; k < order.size(); k++) {
+		int net = mod.assign[order[k]].net;
+		if (net < 0 or net >= nets) {
+			continue;
+		}
+		for (auto reader = readers[net].begin(); reader != readers[net].end(); reader++) {
+			if (--waiting[*reader] == 0) {
+				order.push_back(*reader);
+			}
+		}
+	}
+	for (int i = 0; i < (int)mod.assign.size(); i++) {
+		if (waiting[i] > 0) {
+			errors.push_back("combinational loop through " + netName(mod.assign[i].net));
+			order.push_back(i);
+		}
+	}
+
+	for (auto i = order.begin(); i != order.end(); i++) {
+		const Assign &assign = mod.assign[*i];
+		if (assign.net >= 0 and assign.net < nets) {
+			compiler.store(assign.net, compiler.expression(assign.expr, settleProgram), settleProgram);
+		}
+	}
+
+	// Every register keeps its value unless a rule writes it
+	for (auto reg = registers.begin(); reg != registers.end(); reg++) {
+		clockProgram.push_back(Instruction(Instruction::COPY, reg->second, reg->first));
+	}
+	bool hasReset = mod.reset >= 0 and mod.reset < nets;
+	if (hasReset) {
+		clockProgram.push_back(Instruction(Instruction::LNOT, notReset, mod.reset, -1, -1, 1));
+	}
+
+	auto writeIf = [&](int enable, const Assign &assign) {
+		if (assign.net < 0 or assign.net >= nets) {
+			errors.push_back("assign to undefined net " + netName(assign.net));
+			return;
+		}
+		pair<int, int> value = compiler.expression(assign.expr, clockProgram);
+		int dst = next[assign.net];
+		clockProgram.push_back(Instruction(Instruction::MERGE, dst, enable, value.first, -1, mask[assign.net]));
+	};
+
+	int one = compiler.constant(1);
+	for (auto block = mod.blocks.begin(); block != mod.blocks.end(); block++) {
+		int run = one;
+		if (hasReset and not block->reset.empty()) {
+			for (auto assign = block->reset.begin(); assign != block->reset.end(); assign++) {
+				writeIf(mod.reset, *assign);
+			}
+			run = notReset;
+		}
+
+		clockProgram.push_back(Instruction(Instruction::COPY, any, compiler.constant(0)));
+		clockProgram.push_back(Instruction(Instruction::COPY, taken, compiler.constant(0)));
+		for (auto rule = block->rules.begin(); rule != block->rules.end(); rule++) {
+			pair<int, int> guard = compiler.expression(rule->guard, clockProgram);
+			if (rule->isChained) {
+				// else-if of the rules before it
+				int guarded = compiler.temp();
+				int notTaken = compiler.temp();
+				clockProgram.push_back(Instruction(Instruction::LAND, guarded, guard.first, run, -1, 1));
+				clockProgram.push_back(Instruction(Instruction::LNOT, notTaken, taken, -1, -1, 1));
+				clockProgram.push_back(Instruction(Instruction::LAND, fire, guarded, notTaken, -1, 1));
+				clockProgram.push_back(Instruction(Instruction::MERGE, taken, fire, one, -1, 1));
+			} else {
+				clockProgram.push_back(Instruction(Instruction::LAND, fire, guard.first, run, -1, 1));
+				clockProgram.push_back(Instruction(Instruction::COPY, taken, fire, -1, -1, 1));
+			}
+			clockProgram.push_back(Instruction(Instruction::MERGE, any, fire, one, -1, 1));
+
+			for (auto assign = rule->assign.begin(); assign != rule->assign.end(); assign++) {
+				writeIf(fire, *assign);
+			}
+		}
+
+		if (not block->_else.empty()) {
+			int none = compiler.temp();
+			clockProgram.push_back(Instruction(Instruction::LNOT, none, any, -1, -1, 1));
+			clockProgram.push_back(Instruction(Instruction::LAND, otherwise, none, run, -1, 1));
+		}
+		for (auto rule = block->_else.begin(); rule != block->_else.end(); rule++) {
+			pair<int, int> guard = compiler.expression(rule->guard, clockProgram);
+			clockProgram.push_back(Instruction(Instruction::LAND, fire, guard.first, otherwise, -1, 1));
+			for (auto assign = rule->assign.begin(); assign != rule->assign.end(); assign++) {
+				writeIf(fire, *assign);
+			}
+		}
+	}
+
+	for (auto reg = registers.begin(); reg != registers.end(); reg++) {
+		clockProgram.push_back(Instruction(Instruction::COPY, reg->first, reg->second));
+	}
+
+	// Temporaries go after the constants
+	int tempBase = compiler.constBase + (int)compiler.constants.size();
+	slots = tempBase + compiler.maxTemps;
+	for (vector<Instruction> *program : {&settleProgram, &clockProgram}) {
+		for (auto ins = program->begin(); ins != program->end(); ins++) {
+			for (int *s : {&ins->dst, &ins->a, &ins->b, &ins->c}) {
+				if (*s >= TEMP) {
+					*s = tempBase + *s - TEMP;
+				}
+			}
+		}
+	}
+
+	// Past a chunk, every slot is padded out to whole chunks. The padding
+	// lanes compute garbage nobody reads.
+	stride = this->lanes < CHUNK ? this->lanes : (this->lanes + CHUNK - 1)/CHUNK*CHUNK;
+	values.assign((size_t)slots*stride, 0);
+	for (auto c = compiler.constants.begin(); c != compiler.constants.end(); c++) {
+		std::fill(slot(c->second), slot(c->second) + stride, c->first);
+	}
+}
+
+BatchSimulator::~BatchSimulator() {
+}
+
+uint64_t *BatchSimulator::slot(int index) {
+	return values.data() + (size_t)index*stride;
+}
+
+const uint64_t *BatchSimulator::slot(int index) const {
+	return values.data() + (size_t)index*stride;
+}
+
+uint64_t *BatchSimulator::lane(int net) {
+	return slot(net);
+}
+
+const uint64_t *BatchSimulator::lane(int net) const {
+	return slot(net);
+}
+
+uint64_t BatchSimulator::get(int net, int lane) const {
+	return slot(net)[lane];
+}
+
+void BatchSimulator::set(int net, int lane, uint64_t value) {
+	slot(net)[lane] = value & mask[net];
+}
+
+void BatchSimulator::setAll(int net, uint64_t value) {
+	std::fill(slot(net), slot(net) + lanes, value & mask[net]);
+}
+
+// d = f(a, b, c, d) & m over the lanes of a chunk. Slots never alias the
+// slot an Instruction writes, and N > 0 fixes the trip count, which lets
+// the compiler vectorize the loop.
+template <int N, typename F>
+inline void forLanes(uint64_t *__restrict d, const uint64_t *__restrict a, const uint64_t *__restrict b, const uint64_t *__restrict c, int n, uint64_t m, F f) {
+	const int count = N > 0 ? N : n;
+	for (int l = 0; l < count; l++) {
+		d[l] = f(a[l], b[l], c[l], d[l]) & m;
+	}
+}
+
+template <int N>
+void execute(BatchSimulator &sim, const vector<Instruction> &program, int base, int n) {
+	for (auto ins = program.begin(); ins != program.end(); ins++) {
+		uint64_t *d = sim.slot(ins->dst) + base;
+		const uint64_t *a = sim.slot(ins->a) + base;
+		const uint64_t *b = ins->b >= 0 ? sim.slot(ins->b) + base : a;
+		const uint64_t *c = ins->c >= 0 ? sim.slot(ins->c) + base : a;
+		uint64_t m = ins->mask;
+
+#define LANES(expr) forLanes<N>(d, a, b, c, n, m, [](uint64_t x, uint64_t y, uint64_t z, uint64_t w) { return (uint64_t)(expr); }); break
+		switch (ins->op) {
+			case Instruction::COPY: LANES(x);
+			case Instruction::NOT: LANES(~x);
+			case Instruction::NEG: LANES(-x);
+			case Instruction::LNOT: LANES(x == 0);
+			case Instruction::AND: LANES(x & y);
+			case Instruction::OR: LANES(x | y);
+			case Instruction::XOR: LANES(x ^ y);
+			case Instruction::LAND: LANES(x != 0 and y != 0);
+			case Instruction::LOR: LANES(x != 0 or y != 0);
+			case Instruction::LXOR: LANES((x != 0) != (y != 0));
+			case Instruction::EQ: LANES(x == y);
+			case Instruction::NE: LANES(x != y);
+			case Instruction::LT: LANES(x < y);
+			case Instruction::GT: LANES(x > y);
+			case Instruction::LE: LANES(x <= y);
+			case Instruction::GE: LANES(x >= y);
+			case Instruction::SHL: LANES(y >= 64 ? 0 : x << y);
+			case Instruction::SHR: LANES(y >= 64 ? 0 : x >> y);
+			case Instruction::ADD: LANES(x + y);
+			case Instruction::SUB: LANES(x - y);
+			case Instruction::MUL: LANES(x * y);
+			case Instruction::DIV: LANES(y == 0 ? 0 : x / y);
+			case Instruction::MOD: LANES(y == 0 ? 0 : x % y);
+			case Instruction::SELECT: LANES(x != 0 ? y : z);
+			case Instruction::MERGE: LANES(x != 0 ? y : w);
+		}
+#undef LANES
+	}
+}
+
+void BatchSimulator::run(const vector<Instruction> &program, int base) {
+	if (stride - base >= CHUNK) {
+		execute<CHUNK>(*this, program, base, CHUNK);
+	} else {
+		execute<0>(*this, program, base, stride - base);
+	}
+}
+
+void BatchSimulator::evaluate() {
+	for (int base = 0; base < lanes; base += CHUNK) {
+		run(settleProgram, base);
+	}
+}
+
+void BatchSimulator::tick() {
+	for (int base = 0; base < lanes; base += CHUNK) {
+		run(clockProgram, base);
+	}
+}
+
+void BatchSimulator::step(int cycles) {
+	// lanes are independent, so each chunk runs every cycle while it is in
+	// cache
+	for (int base = 0; base < lanes; base += CHUNK) {
+		for (int cycle = 0; cycle < cycles; cycle++) {
+			run(settleProgram, base);
+			run(clockProgram, base);
+		}
+	}
+}
+
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "module.h"
+
+namespace clocked {
+
+// One lane-parallel operation of a compiled Module, see BatchSimulator.
+// Operands and result are slots, each an array of one word per lane. The
+// result is masked to the width of whatever it computes.
+struct Instruction {
+	enum Op {
+		COPY,
+		NOT,
+		NEG,
+		LNOT,
+		AND,
+		OR,
+		XOR,
+		LAND,
+		LOR,
+		LXOR,
+		EQ,
+		NE,
+		LT,
+		GT,
+		LE,
+		GE,
+		SHL,
+		SHR,
+		ADD,
+		SUB,
+		MUL,
+		DIV,
+		MOD,
+		// dst = a ? b : c
+		SELECT,
+		// dst = a ? b : dst
+		MERGE,
+	};
+
+	Instruction(Op op=COPY, int dst=-1, int a=-1, int b=-1, int c=-1, uint64_t mask=~(uint64_t)0);
+	~Instruction();
+
+	Op op;
+	int dst;
+	int a, b, c;
+	uint64_t mask;
+};
+
+// Simulates many independent copies of the same Module in lockstep, one
+// lane per copy. State is kept as a struct of arrays: every net, and every
+// intermediate value of the compiled program, is a contiguous array of one
+// word per lane, so each Instruction is a single loop over the lanes that
+// the compiler can vectorize.
+//
+// Every Block is taken to be clocked by the rising edge of the same clock.
+// A Block with reset assigns takes them instead of its rules while the
+// reset net is high. Each rule starts a new if unless it isChained onto
+// the one before it, writes of later rules win, and the _else rules are
+// checked only when none of the rules fired. Values are unsigned and at
+// most 64 bits wide, divide and mod by zero give zero. A Module with a
+// wider net isn't simulated at all: the simulator is left empty, with no
+// mod and no lanes, and errors names the nets.
+struct BatchSimulator {
+	BatchSimulator();
+	BatchSimulator(const Module &mod, int lanes);
+	~BatchSimulator();
+
+	const Module *mod;
+	int lanes;
+
+	// Every slot is stride words, the first lanes of which are in use. Nets
+	// come first, in the order of mod.nets, then the next state of the
+	// registers written by rules, then the constants and temporaries of the
+	// program.
+	int stride;
+	int slots;
+	vector<uint64_t> values;
+	// Mask of each net's width
+	vector<uint64_t> mask;
+
+	// Continuous assigns in dependency order
+	vector<Instruction> settleProgram;
+	// Rules of every Block, writing next state slots
+	vector<Instruction> clockProgram;
+	// Registers written by the clock program and their next state slot
+	vector<pair<int, int> > registers;
+
+	// Why the Module can't be simulated exactly. Unsupported operators
+	// evaluate to zero, and the assigns on a combinational loop are
+	// evaluated once in Module order. Nets wider than 64 bits are listed
+	// here and leave mod null.
+	vector<string> errors;
+
+	uint64_t *slot(int index);
+	const uint64_t *slot(int index) const;
+
+	// The values of net in every lane, for driving inputs and reading
+	// outputs a whole batch at a time
+	uint64_t *lane(int net);
+	const uint64_t *lane(int net) const;
+
+	uint64_t get(int net, int lane) const;
+	void set(int net, int lane, uint64_t value);
+	void setAll(int net, uint64_t value);
+
+	// Settle the continuous assigns. WIRE and OUT nets are only up to date
+	// with the IN and REG nets after this.
+	void evaluate();
+	// Rising clock edge, every register takes its next state from the
+	// settled values
+	void tick();
+	// evaluate() then tick(), cycles times
+	void step(int cycles=1);
+
+	// Run program over the chunk of lanes from base
+	void run(const vector<Instruction> &program, int base);
+};
+
+}
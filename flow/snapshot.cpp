@@ -0,0 +1,231 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace clocked {
+
+static const char MAGIC[8] = {'F', 'L', 'O', 'W', 'S', 'N', 'A', 'P'};
+static const uint64_t VERSION = 1;
+
+static int widthOf(const BatchSimulator &sim, int net) {
+	return std::max(sim.mod->nets[net].type.width, 1);
+}
+
+static size_t wordsOf(const string &name) {
+	return (name.size() + 7)/8;
+}
+
+static size_t wordsOf(int lanes, int width) {
+	return ((size_t)lanes*width + 63)/64;
+}
+
+// Reads words out of a snapshot, failing once it runs past the end
+struct SnapshotReader {
+	const uint8_t *ptr;
+	const uint8_t *end;
+
+	bool word(uint64_t &value) {
+		if (end - ptr < 8) {
+			return false;
+		}
+		memcpy(&value, ptr, 8);
+		ptr += 8;
+		return true;
+	}
+
+	bool text(string &value, uint64_t size) {
+		// names are padded out to whole words
+		if (size > (uint64_t)(end - ptr) or (size + 7)/8*8 > (uint64_t)(end - ptr)) {
+			return false;
+		}
+		value.assign((const char*)ptr, size);
+		ptr += (size + 7)/8*8;
+		return true;
+	}
+};
+
+vector<int> snapshotNets(const BatchSimulator &sim) {
+	if (sim.mod == nullptr) {
+		return vector<int>();
+	}
+
+	vector<bool> held(sim.mod->nets.size(), false);
+	for (int net = 0; net < (int)sim.mod->nets.size(); net++) {
+		Net::Purpose purpose = sim.mod->nets[net].purpose;
+		held[net] = (purpose == Net::Purpose::REG or purpose == Net::Purpose::IN);
+	}
+	for (auto reg = sim.registers.begin(); reg != sim.registers.end(); reg++) {
+		held[reg->first] = true;
+	}
+
+	vector<int> result;
+	for (int net = 0; net < (int)held.size(); net++) {
+		if (held[net]) {
+			result.push_back(net);
+		}
+	}
+	return result;
+}
+
+vector<uint8_t> checkpoint(const BatchSimulator &sim) {
+	vector<int> nets = snapshotNets(sim);
+
+	size_t size = 4;
+	for (auto net = nets.begin(); net != nets.end(); net++) {
+		size += 3 + wordsOf(sim.mod->nets[*net].name) + wordsOf(sim.lanes, widthOf(sim, *net));
+	}
+	vector<uint64_t> words;
+	words.reserve(size);
+
+	uint64_t magic;
+	memcpy(&magic, MAGIC, 8);
+	words.push_back(magic);
+	words.push_back(VERSION);
+	words.push_back((uint64_t)sim.lanes);
+	words.push_back(nets.size());
+	for (auto net = nets.begin(); net != nets.end(); net++) {
+		const string &name = sim.mod->nets[*net].name;
+		words.push_back((uint64_t)*net);
+		words.push_back((uint64_t)widthOf(sim, *net));
+		words.push_back(name.size());
+		size_t at = words.size();
+		words.resize(at + wordsOf(name), 0);
+		memcpy(words.data() + at, name.data(), name.size());
+	}
+
+	for (auto net = nets.begin(); net != nets.end(); net++) {
+		int width = widthOf(sim, *net);
+		size_t at = words.size();
+		words.resize(at + wordsOf(sim.lanes, width), 0);
+		uint64_t *packed = words.data() + at;
+		const uint64_t *values = sim.lane(*net);
+		if (width == 64) {
+			std::copy(values, values + sim.lanes, packed);
+			continue;
+		}
+		for (int lane = 0; lane < sim.lanes; lane++) {
+			size_t bit = (size_t)lane*width;
+			int offset = (int)(bit%64);
+			packed[bit/64] |= values[lane] << offset;
+			if (offset + width > 64) {
+				packed[bit/64 + 1] |= values[lane] >> (64 - offset);
+			}
+		}
+	}
+
+	vector<uint8_t> result(words.size()*8);
+	memcpy(result.data(), words.data(), result.size());
+	return result;
+}
+
+bool checkpoint(const BatchSimulator &sim, string path) {
+	vector<uint8_t> data = checkpoint(sim);
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	return file and file.write((const char*)data.data(), data.size());
+}
+
+bool restore(BatchSimulator &sim, const uint8_t *data, size_t size) {
+	if (sim.mod == nullptr or data == nullptr) {
+		return false;
+	}
+
+	// Check the whole header against sim before touching it
+	SnapshotReader in{data, data + size};
+	uint64_t magic = 0, version = 0, lanes = 0, count = 0;
+	vector<int> nets = snapshotNets(sim);
+	if (size < 8 or memcmp(data, MAGIC, 8) != 0
+		or not in.word(magic) or not in.word(version) or version != VERSION
+		or not in.word(lanes) or (lanes != 1 and lanes != (uint64_t)sim.lanes)
+		or not in.word(count) or count != nets.size()) {
+		return false;
+	}
+
+	size_t packed = 0;
+	for (auto net = nets.begin(); net != nets.end(); net++) {
+		uint64_t index = 0, width = 0, length = 0;
+		string name;
+		if (not in.word(index) or index != (uint64_t)*net
+			or not in.word(width) or width != (uint64_t)widthOf(sim, *net)
+			or not in.word(length) or not in.text(name, length)
+			or name != sim.mod->nets[*net].name) {
+			return false;
+		}
+		packed += wordsOf((int)lanes, (int)width);
+	}
+	if ((size_t)(in.end - in.ptr)/8 < packed) {
+		return false;
+	}
+
+	for (auto net = nets.begin(); net != nets.end(); net++) {
+		int width = widthOf(sim, *net);
+		uint64_t mask = sim.mask[*net];
+		uint64_t *values = sim.lane(*net);
+		for (int lane = 0; lane < (int)lanes; lane++) {
+			size_t bit = (size_t)lane*width;
+			int offset = (int)(bit%64);
+			uint64_t word = 0;
+			memcpy(&word, in.ptr + bit/64*8, 8);
+			uint64_t value = word >> offset;
+			if (offset + width > 64) {
+				memcpy(&word, in.ptr + (bit/64 + 1)*8, 8);
+				value |= word << (64 - offset);
+			}
+			values[lane] = value & mask;
+		}
+		if (lanes == 1) {
+			std::fill(values + 1, values + sim.lanes, values[0]);
+		}
+		in.ptr += wordsOf((int)lanes, width)*8;
+	}
+
+	sim.evaluate();
+	return true;
+}
+
+bool restore(BatchSimulator &sim, const vector<uint8_t> &data) {
+	return restore(sim, data.data(), data.size());
+}
+
+bool restore(BatchSimulator &sim, string path) {
+#if defined(__unix__) || defined(__APPLE__)
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 or info.st_size <= 0) {
+		::close(fd);
+		return false;
+	}
+	size_t size = (size_t)info.st_size;
+	void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (mapped != MAP_FAILED) {
+		bool result = restore(sim, (const uint8_t*)mapped, size);
+		munmap(mapped, size);
+		return result;
+	}
+#endif
+
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (not file) {
+		return false;
+	}
+	vector<uint8_t> data((size_t)file.tellg());
+	file.seekg(0);
+	if (not file.read((char*)data.data(), data.size())) {
+		return false;
+	}
+	return restore(sim, data);
+}
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "simulate.h"
+
+namespace clocked {
+
+// Checkpoints of a BatchSimulator, so that many scenarios can fork from
+// the same warmed up state instead of replaying it.
+//
+// A snapshot holds every net a clock edge carries over to the next cycle:
+// the REG nets, which for a synthesized Module are its valid bits, branch
+// registers and queue slots, any other net a Block writes, and the IN
+// nets as last driven. Each net is bit packed to its width across the
+// lanes. The layout is "FLOWSNAP", then 64-bit words: the version, the
+// number of lanes and nets, the index, width and name of each net, then
+// the packed lanes of each net. Words are in native byte order and every
+// section is word aligned, so a mapped file is restored in place.
+
+// The nets a snapshot of sim holds, in the order it holds them
+vector<int> snapshotNets(const BatchSimulator &sim);
+
+vector<uint8_t> checkpoint(const BatchSimulator &sim);
+bool checkpoint(const BatchSimulator &sim, string path);
+
+// Load a snapshot taken from the same Module into sim and settle it. A
+// snapshot of one lane is copied to every lane, otherwise the number of
+// lanes must match. Returns false, leaving sim untouched, if the
+// snapshot doesn't fit.
+bool restore(BatchSimulator &sim, const uint8_t *data, size_t size);
+bool restore(BatchSimulator &sim, const vector<uint8_t> &data);
+// The file is memory mapped where the platform allows
+bool restore(BatchSimulator &sim, string path);
+
+}
@@ -0,0 +1,243 @@
+#include "specialize.h"
+
+#include <algorithm>
+#include <map>
+
+#include <arithmetic/algorithm.h>
+
+#include "index.h"
+#include "optimize.h"
+
+using arithmetic::Operation;
+
+namespace flow {
+
+bool isSingle(const Range &range) {
+	return range.isKnown() and range.bounded and range.lo == range.hi;
+}
+
+bool isSame(const Range &r0, const Range &r1) {
+	return r0.width == r1.width and r0.bounded == r1.bounded
+		and (not r0.bounded or (r0.lo == r1.lo and r0.hi == r1.hi));
+}
+
+// Result of the comparison if args decide it, -1 otherwise
+int decideComparison(int func, const vector<Range> &args) {
+	if (args.size() != 2 or not args[0].isKnown() or not args[0].bounded
+		or not args[1].isKnown() or not args[1].bounded) {
+		return -1;
+	}
+
+	const Range &a = args[0], &b = args[1];
+	switch (func) {
+		case Operation::OpType::LESS:
+			return a.hi < b.lo ? 1 : (a.lo >= b.hi ? 0 : -1);
+		case Operation::OpType::GREATER:
+			return a.lo > b.hi ? 1 : (a.hi <= b.lo ? 0 : -1);
+		case Operation::OpType::LESS_EQUAL:
+			return a.hi <= b.lo ? 1 : (a.lo > b.hi ? 0 : -1);
+		case Operation::OpType::GREATER_EQUAL:
+			return a.lo >= b.hi ? 1 : (a.hi < b.lo ? 0 : -1);
+		case Operation::OpType::EQUAL:
+			return (isSingle(a) and isSingle(b) and a.lo == b.lo) ? 1 : ((a.hi < b.lo or b.hi < a.lo) ? 0 : -1);
+		case Operation::OpType::NOT_EQUAL:
+			return (isSingle(a) and isSingle(b) and a.lo == b.lo) ? 0 : ((a.hi < b.lo or b.hi < a.lo) ? 1 : -1);
+		default:
+			return -1;
+	}
+}
+
+Expression specializeExpression(const Expression &e, const vector<Range> &nets) {
+	auto single = [&](const Operand &operand) {
+		return operand.isVar() and operand.index < nets.size() and isSingle(nets[operand.index]);
+	};
+
+	if (single(e.top)) {
+		return Expression::intOf(nets[e.top.index].lo);
+	} else if (not e.top.isExpr()) {
+		return e;
+	}
+
+	Expression result = e;
+	map<size_t, Range> exprs;
+	for (arithmetic::PostOrderDFSIterator operation_it(e.sub, {e.top}); !operation_it.done(); ++operation_it) {
+		Operation operation = *operation_it;
+		bool changed = false;
+		vector<Range> args;
+		for (auto operand = operation.operands.begin(); operand != operation.operands.end(); operand++) {
+			if (single(*operand)) {
+				*operand = Operand::intOf(nets[operand->index].lo);
+				changed = true;
+			}
+
+			if (operand->isConst()) {
+				args.push_back(rangeOfConst(operand->cnst));
+			} else if (operand->isVar() and operand->index < nets.size()) {
+				args.push_back(nets[operand->index]);
+			} else if (operand->isExpr() and exprs.find(operand->index) != exprs.end()) {
+				args.push_back(exprs[operand->index]);
+			} else {
+				args.push_back(Range::unknown());
+			}
+		}
+
+		int decided = decideComparison(operation.func, args);
+		if (decided >= 0) {
+			operation = Operation(Operation::OpType::IDENTITY, {Operand(decided == 1)});
+			operation.exprIndex = operation_it->exprIndex;
+			exprs[operation.exprIndex] = Range(decided, decided);
+			changed = true;
+		} else {
+			exprs[operation.exprIndex] = rangeOfOperation(operation.func, args);
+		}
+
+		if (changed) {
+			result.sub.setExpr(operation);
+		}
+	}
+
+	result.minimize();
+	return result;
+}
+
+int specializeFunc(Func &func, const vector<Range> &inputs) {
+	vector<Range> ranges = inferRanges(func, inputs);
+	for (auto cond = func.conds.begin(); cond != func.conds.end(); cond++) {
+		// a guard that can't hold can't fire, whatever it waits on
+		if (isUnsatisfiable(specializeExpression(cond->valid, ranges))) {
+			cond->valid = Expression::boolOf(false);
+			continue;
+		}
+
+		vector<Range> local = ranges;
+		for (size_t net = 0; net < func.nets.size(); net++) {
+			if (func.nets[net].purpose == Net::Purpose::IN
+				and std::find(cond->ins.begin(), cond->ins.end(), (int)net) == cond->ins.end()) {
+				local[net] = Range::unknown();
+			}
+		}
+
+		cond->valid = specializeExpression(cond->valid, local);
+		for (auto reg = cond->regs.begin(); reg != cond->regs.end(); reg++) {
+			reg->second = specializeExpression(reg->second, local);
+		}
+		for (auto out = cond->outs.begin(); out != cond->outs.end(); out++) {
+			out->second = specializeExpression(out->second, local);
+		}
+	}
+	return eliminateUnreachableConds(func);
+}
+
+vector<Range> propagateRanges(const Graph &graph) {
+	vector<Range> arcs;
+	for (auto arc = graph.arcs.begin(); arc != graph.arcs.end(); arc++) {
+		Range range = Range::unknown();
+		if (arc->to >= 0 and arc->to < (int)graph.nodes.size()) {
+			const Func &consumer = graph.funcs[graph.nodes[arc->to]];
+			if (arc->toPort >= 0 and arc->toPort < (int)consumer.nets.size()) {
+				range = Range::ofType(consumer.nets[arc->toPort].type);
+			}
+		}
+		arcs.push_back(range);
+	}
+
+	// Nodes on cycles come after the rest, they settle over the rounds
+	GraphIndex index(graph);
+	vector<int> order = topologicalSort(index);
+	vector<bool> ordered(graph.nodes.size(), false);
+	for (auto node = order.begin(); node != order.end(); node++) {
+		ordered[*node] = true;
+	}
+	for (int node = 0; node < index.nodes; node++) {
+		if (not ordered[node]) {
+			order.push_back(node);
+		}
+	}
+
+	// Every round is sound on its own, the cap only stops long oscillations
+	bool changed = true;
+	for (int round = 0; changed and round <= index.nodes+1; round++) {
+		changed = false;
+		for (auto node = order.begin(); node != order.end(); node++) {
+			const Func &func = graph.funcs[graph.nodes[*node]];
+			vector<Range> inputs(func.nets.size(), Range::unknown());
+			for (int arc : index.fanin(*node)) {
+				int port = graph.arcs[arc].toPort;
+				if (port >= 0 and port < (int)inputs.size()) {
+					inputs[port] = arcs[arc];
+				}
+			}
+			vector<Range> ranges = inferRanges(func, inputs);
+
+			for (int arc : index.fanout(*node)) {
+				int port = graph.arcs[arc].fromPort;
+				if (port < 0 or port >= (int)func.nets.size()) {
+					continue;
+				}
+
+				// the tokens sent are what gets written, not the reset value
+				bool written = false;
+				Range sent;
+				for (auto cond = func.conds.begin(); cond != func.conds.end(); cond++) {
+					for (auto out = cond->outs.begin(); out != cond->outs.end(); out++) {
+						if (out->first == port) {
+							Range value = inferRange(out->second, ranges).clamp(func.nets[port].type.width);
+							sent = written ? sent.hull(value) : value;
+							written = true;
+						}
+					}
+				}
+				if (written and not isSame(sent, arcs[arc])) {
+					arcs[arc] = sent;
+					changed = true;
+				}
+			}
+		}
+	}
+	return arcs;
+}
+
+int specializeGraph(Graph &graph) {
+	vector<Range> arcs = propagateRanges(graph);
+	GraphIndex index(graph);
+
+	int removed = 0;
+	for (int node = 0; node < index.nodes; node++) {
+		Func func = graph.funcs[graph.nodes[node]];
+		vector<Range> inputs(func.nets.size(), Range::unknown());
+		bool narrower = false;
+		for (int arc : index.fanin(node)) {
+			int port = graph.arcs[arc].toPort;
+			if (port >= 0 and port < (int)inputs.size()) {
+				inputs[port] = arcs[arc];
+				narrower = narrower or not isSame(arcs[arc], Range::ofType(func.nets[port].type));
+			}
+		}
+		if (not narrower) {
+			continue;
+		}
+
+		// a copy is a different Module, so it needs a name of its own
+		removed += specializeFunc(func, inputs);
+		func.name += "_" + ::to_string(node);
+		graph.nodes[node] = (int)graph.funcs.size();
+		graph.funcs.push_back(func);
+	}
+
+	// drop the Funcs no node uses anymore
+	vector<int> funcMap(graph.funcs.size(), -1);
+	vector<Func> used;
+	for (auto node = graph.nodes.begin(); node != graph.nodes.end(); node++) {
+		if (funcMap[*node] < 0) {
+			funcMap[*node] = (int)used.size();
+			used.push_back(graph.funcs[*node]);
+		}
+		*node = funcMap[*node];
+	}
+	graph.funcs = used;
+
+	graph.dedupFuncs();
+	return removed;
+}
+
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+
+#include "graph.h"
+#include "width.h"
+
+namespace flow {
+
+// Replace the reads of every net whose range holds a single value with
+// that value, and every comparison the ranges decide with its result.
+Expression specializeExpression(const Expression &e, const vector<Range> &nets);
+
+// Specialize the guards and writes of func to the range of each of its IN
+// nets, indexed by net, and drop the Conditions that can no longer fire.
+// Only the inputs a Condition acknowledges are replaced in it, since
+// reading the others is what makes it wait for them to be valid. Nets are
+// left alone so the ports of the Func don't move. Returns the number of
+// Conditions removed.
+int specializeFunc(Func &func, const vector<Range> &inputs);
+
+// Range of the tokens on every arc of graph, indexed like graph.arcs. Every
+// arc starts out with the declared range of its channel, and each round
+// recomputes what the producers can send given what they receive, nodes in
+// topological order, until nothing changes.
+vector<Range> propagateRanges(const Graph &graph);
+
+// Specialize the Func of every node to the tokens that can arrive on its
+// arcs. Each node with narrower inputs gets its own copy of its Func,
+// named after the original and the node, Funcs no node uses are dropped,
+// and copies that end up identical are merged again by dedupFuncs().
+// Returns the number of Conditions removed over all nodes.
+int specializeGraph(Graph &graph);
+
+}
@@ -1,20 +1,42 @@
 #include <algorithm>
+#include <bit>
 #include <functional>
 #include <iterator>
+#include <map>
 #include <set>
+#include <thread>
+#include <tuple>
 
 #include <arithmetic/algorithm.h>
 #include <common/mapping.h>
 #include <common/math.h>
 #include <interpret_arithmetic/export_verilog.h>
 
+#include "flatten.h"
+#include "optimize.h"
+#include "pipeline.h"
 #include "synthesize.h"
+#include "trace.h"
+#include "width.h"
 
 using arithmetic::Expression;
 using arithmetic::Operation;
 
 namespace flow {
 
+SynthesisOptions::SynthesisOptions() {
+	pipelineDepth = 0;
+	shareOperators = false;
+	strengthReduction = false;
+	resetDatapath = true;
+	perfCounters = false;
+	counterWidth = 32;
+	threads = 1;
+}
+
+SynthesisOptions::~SynthesisOptions() {
+}
+
 clocked::Type synthesizeChannelType(const Type &type) {
 	clocked::Type result;
 	if (type.type == flow::Type::TypeName::BITS) {
@@ -55,8 +77,8 @@ bool isBooleanOperation(const Operation &operation) {
 }
 
 
-Expression synthesizeExpressionProbes(const Expression &e, const Mapping<size_t> &ChannelToValid, const Mapping<size_t> &ChannelToData) {
-	//cout << endl << endl << "<<<<<<<<<<<>>>>>>>>>>>" << endl;
+template <typename Trace>
+Expression synthesizeExpressionProbes(const Expression &e, const Mapping<size_t> &ChannelToValid, const Mapping<size_t> &ChannelToData, Trace &trace) {
 	Expression result(e);
 
 	//TODO: verify that we're only substituting channel references, not local vars (if mistakenly probed)
@@ -68,7 +90,6 @@ Expression synthesizeExpressionProbes(const Expression &e, const Mapping<size_t>
 	//);
 
 	auto emplaceProbe = [&](size_t parent_expr_operation_idx, size_t channel_idx) {
-		//cout << " ~ ~ emplace: e" << parent_expr_operation_idx << " <- v" << channel_idx << " ~ ~" << endl;
 		Operation substitution(Operation::OpType::IDENTITY, {Operand::varOf(channel_idx)});
 		substitution.exprIndex = parent_expr_operation_idx;
 		result.sub.setExpr(substitution);
@@ -76,7 +97,6 @@ Expression synthesizeExpressionProbes(const Expression &e, const Mapping<size_t>
 
 	size_t subexpr_count = e.sub.size();
 	if (subexpr_count == 0) {
-		//cout << ">>>>>>>>>>> early, no probes <<<<<<<<<<<" << endl;
 		return e;
 
 	} else if (subexpr_count == 1) {
@@ -87,30 +107,25 @@ Expression synthesizeExpressionProbes(const Expression &e, const Mapping<size_t>
 		size_t channel_idx = 0;
 		//size_t channel_data = ChannelToData.map(channel_idx);
 		size_t channel_valid = ChannelToValid.map(channel_idx);
-		//cout << "probe channel v" << channel_idx << " [v:" << channel_valid << ",d:" << channel_data << "]" << endl;
 		emplaceProbe(0, channel_valid);
+		trace.probe(channel_idx, channel_valid, ChannelToData.map(channel_idx));
 
-		//cout << ">>>>>>>>>>> early, expr is just 1 probe <<<<<<<<<<<" << endl;
-		result.minimize();
+		minimize(result, trace);
 		return result;
 	}
 
-	//cout << "Post-order DFS:" << endl;
 	vector<Operation> child_probes;
 	for (arithmetic::PostOrderDFSIterator operation_it(e.sub, {e.top}); !operation_it.done(); ++operation_it) {
 		const Operation &operation = *operation_it;
-		//cout << "==> e" << operation.exprIndex;
 
 		// Descend down to all probe() calls
 		if (isProbeCall(operation)) {
-			//cout << endl;
 			child_probes.push_back(operation);
 			continue;
 		}
 
 		// New, lower "or" ceiling?
 		if (operation.func == Operation::OpType::BOOLEAN_OR) {
-			//cout << "!!" << endl;
 			size_t parent_operation_idx = operation.exprIndex;
 			Operation parent_operation = *e.getExpr(parent_operation_idx);
 
@@ -123,12 +138,10 @@ Expression synthesizeExpressionProbes(const Expression &e, const Mapping<size_t>
 				size_t channel_idx = probe_operation.operands[1].index;
 				size_t channel_data = ChannelToData.map(channel_idx);
 				size_t channel_valid = ChannelToValid.map(channel_idx);
-				//cout << "  \\___> " << child_operation_idx << endl;
-				//cout << "probe channel v" << channel_idx << " [v:" << channel_valid << ",d:" << channel_data << "]" << endl;
-				//cout << "       parent e" << parent_operation_idx << endl;
 
 				emplaceProbe(child_operation_idx, channel_data);
 				new_parent_operands.insert(new_parent_operands.begin(), Operand::varOf(channel_valid));
+				trace.probe(channel_idx, channel_valid, channel_data);
 			}
 			child_probes.clear();
 
@@ -139,14 +152,11 @@ Expression synthesizeExpressionProbes(const Expression &e, const Mapping<size_t>
 		}
 
 		//TODO: when backtracking, pop off ceiling
-		//cout << valid_regions.back() << endl;
-		//cout << endl;
 	}
 
 	//TODO: extract base case para merge two near-identical substitutions 
 	// Synthesize leftover probes not nested within any BOOLEAN_OR
 	if (!child_probes.empty()) {
-		//cout << endl << "...nobody's kids?" << endl;
 		size_t parent_operation_idx = e.top.index;  //TODO: e.sub.getExpr(e.top.index); ??
 		Operation parent_operation = *e.getExpr(parent_operation_idx);
 
@@ -159,18 +169,17 @@ Expression synthesizeExpressionProbes(const Expression &e, const Mapping<size_t>
 			size_t channel_idx = probe_operation.operands[1].index;
 			size_t channel_data = ChannelToData.map(channel_idx);
 			size_t channel_valid = ChannelToValid.map(channel_idx);
-			//cout << "  \\___> " << child_operation_idx << endl;
-			//cout << "probe channel v" << channel_idx << " [v:" << channel_valid << ",d:" << channel_data << "]" << endl;
-			//cout << "       parent e" << parent_operation_idx << endl;
 
 			// Base case: top IS probe() call
 			if (parent_operation_idx == child_operation_idx) {
 				emplaceProbe(child_operation_idx, channel_valid);
+				trace.probe(channel_idx, channel_valid, channel_data);
 				break;  //TODO: just return immediately?
 			}
 
 			emplaceProbe(child_operation_idx, channel_data);
 			new_parent_operands.insert(new_parent_operands.begin(), Operand::varOf(channel_valid));
+			trace.probe(channel_idx, channel_valid, channel_data);
 		}
 		child_probes.clear();
 
@@ -179,27 +188,210 @@ Expression synthesizeExpressionProbes(const Expression &e, const Mapping<size_t>
 		result.sub.setExpr(parent_expr_only_when_valid);
 	}
 
-	//cout << endl << "><><<>><><<>><><<>><><" << endl;
-	//cout << "PRE-MINIMIZE:" << endl;
-	//cout << result.to_string();
-	//cout << ">>>>>>>>>>><<<<<<<<<<<" << endl;
-
-	result.minimize();
+	minimize(result, trace);
 	//result.tidy();
 	return result;
 }
 
+Expression synthesizeExpressionProbes(const Expression &e, const Mapping<size_t> &ChannelToValid, const Mapping<size_t> &ChannelToData) {
+	NoTrace trace;
+	return synthesizeExpressionProbes(e, ChannelToValid, ChannelToData, trace);
+}
 
-void synthesizeChannel(clocked::Module &mod, const Net &net) {
+template Expression synthesizeExpressionProbes<NoTrace>(const Expression &e, const Mapping<size_t> &ChannelToValid, const Mapping<size_t> &ChannelToData, NoTrace &trace);
+template Expression synthesizeExpressionProbes<Tracer>(const Expression &e, const Mapping<size_t> &ChannelToValid, const Mapping<size_t> &ChannelToData, Tracer &trace);
+
+
+// Nets of a queue made by synthesizeQueue()
+struct QueueNets {
+	int valid;
+	int data;
+	int space;
+	int push;
+	int pop;
+};
+
+// Ring buffer queue in its own always block. A token is written into the
+// slot at tail when push is high and there is space, and read out of the
+// slot at head through a mux while the queue is valid. Popping a token
+// only moves head, so no slot is written but the one pushed into. space
+// only depends on the count register, so nothing combinational passes
+// from ready to the producer.
+QueueNets synthesizeQueue(clocked::Module &mod, string name, clocked::Type type, int depth, Expression push, Expression pushData, Expression ready, bool resetData) {
 	static const clocked::Type wire(clocked::Type::TypeName::BITS, 1);
-	clocked::Channel channel;
+	clocked::Type pointer(clocked::Type::TypeName::FIXED, std::max((int)std::bit_width((unsigned)depth-1), 1));
+	QueueNets queue;
+
+	mod.blocks.push_back(clocked::Block(Expression::varOf(mod.clk)));
 	clocked::Block &always = mod.blocks.back();
 
-	if (net.purpose == flow::Net::Purpose::IN) {
+	vector<int> slots;
+	for (int i = 0; i < depth; i++) {
+		slots.push_back(mod.pushNet(name+"_slot"+::to_string(i), type, clocked::Net::Purpose::REG));
+		if (resetData) {
+			always.reset.push_back(clocked::Assign(slots.back(), Expression::intOf(0)));
+		}
+	}
+
+	int head = mod.pushNet(name+"_head", pointer, clocked::Net::Purpose::REG);
+	int tail = mod.pushNet(name+"_tail", pointer, clocked::Net::Purpose::REG);
+	int count = mod.pushNet(name+"_count", clocked::Type(clocked::Type::TypeName::FIXED, std::bit_width((unsigned)depth)), clocked::Net::Purpose::REG);
+	always.reset.push_back(clocked::Assign(head, Expression::intOf(0)));
+	always.reset.push_back(clocked::Assign(tail, Expression::intOf(0)));
+	always.reset.push_back(clocked::Assign(count, Expression::intOf(0)));
+	Expression countIs = Expression::varOf(count);
+
+	// head == 0 ? slot0 : head == 1 ? slot1 : ... : slotN-1
+	Expression read = Expression::varOf(slots.back());
+	for (int i = depth-2; i >= 0; i--) {
+		Operand select = read.sub.pushExpr(Operation(Operation::OpType::EQUAL, {Operand::varOf(head), Operand::intOf(i)}));
+		read.top = read.sub.pushExpr(Operation(Operation::OpType::TERNARY, {select, Operand::varOf(slots[i]), read.top}));
+	}
+	queue.data = mod.pushNet(name+"_data", type, clocked::Net::Purpose::WIRE);
+	mod.assign.push_back(clocked::Assign(queue.data, read, true));
+
+	queue.valid = mod.pushNet(name+"_nonempty", wire, clocked::Net::Purpose::WIRE);
+	mod.assign.push_back(clocked::Assign(queue.valid, arithmetic::ident(countIs != Expression::intOf(0)), true));
+	queue.space = mod.pushNet(name+"_space", wire, clocked::Net::Purpose::WIRE);
+	mod.assign.push_back(clocked::Assign(queue.space, arithmetic::ident(countIs != Expression::intOf(depth)), true));
+	queue.push = mod.pushNet(name+"_push", wire, clocked::Net::Purpose::WIRE);
+	mod.assign.push_back(clocked::Assign(queue.push, push && Expression::varOf(queue.space), true));
+	queue.pop = mod.pushNet(name+"_pop", wire, clocked::Net::Purpose::WIRE);
+	mod.assign.push_back(clocked::Assign(queue.pop, Expression::varOf(queue.valid) && ready, true));
+
+	// guards are mutually exclusive per net, so the rules are parallel
+	Expression doPush = Expression::varOf(queue.push);
+	Expression doPop = Expression::varOf(queue.pop);
+	for (int i = 0; i < depth; i++) {
+		always.rules.push_back(clocked::Rule({
+			clocked::Assign(slots[i], pushData),
+		}, doPush && (Expression::varOf(tail) == Expression::intOf(i))));
+	}
+	for (int ptr : {head, tail}) {
+		Expression step = ptr == head ? doPop : doPush;
+		Expression last = Expression::varOf(ptr) == Expression::intOf(depth-1);
+		always.rules.push_back(clocked::Rule({
+			clocked::Assign(ptr, Expression::varOf(ptr) + Expression::intOf(1)),
+		}, step && ~last));
+		always.rules.push_back(clocked::Rule({
+			clocked::Assign(ptr, Expression::intOf(0)),
+		}, step && last));
+	}
+
+	always.rules.push_back(clocked::Rule({
+		clocked::Assign(count, countIs + Expression::intOf(1)),
+	}, doPush && ~doPop));
+	always.rules.push_back(clocked::Rule({
+		clocked::Assign(count, countIs - Expression::intOf(1)),
+	}, doPop && ~doPush));
+
+	return queue;
+}
+
+// Registers that only ever hold a token's data are written before they are
+// read, so they only need a reset if resetData is set.
+void synthesizeChannel(clocked::Module &mod, const Net &net, bool resetData) {
+	static const clocked::Type wire(clocked::Type::TypeName::BITS, 1);
+	clocked::Channel channel;
+	clocked::Block &always = mod.blocks.front();
+
+	if (net.purpose == flow::Net::Purpose::IN and net.protocol == flow::Net::Protocol::CREDIT) {
+		// Tokens land in a queue with a slot for every credit, and every
+		// token popped from it returns a credit to the sender a cycle later
+		size_t valid = mod.pushNet(net.name+"_valid", wire, clocked::Net::Purpose::IN);
+		size_t data = mod.pushNet(net.name+"_data", synthesizeChannelType(net.type), clocked::Net::Purpose::IN);
+		size_t credit = mod.pushNet(net.name+"_credit", wire, clocked::Net::Purpose::OUT);
+		channel.ready = mod.pushNet(net.name+"_ready", wire, clocked::Net::Purpose::WIRE);
+
+		// always is invalidated once the queue adds its block
+		QueueNets queue = synthesizeQueue(mod, net.name+"_queue", synthesizeChannelType(net.type), std::max(net.credits, 1),
+			Expression::varOf(valid), Expression::varOf(data), Expression::varOf(channel.ready), resetData);
+		channel.valid = queue.valid;
+		channel.data = queue.data;
+
+		size_t credit_reg = mod.pushNet(net.name+"_credit_reg", clocked::Type(clocked::Type::TypeName::FIXED, 1), clocked::Net::Purpose::REG);
+		mod.assign.push_back(clocked::Assign(credit, Expression::varOf(credit_reg), true));
+
+		clocked::Block &drain = mod.blocks.back();
+		drain.reset.push_back(clocked::Assign(credit_reg, Expression::intOf(0)));
+		drain.rules.push_back(clocked::Rule({
+			clocked::Assign(credit_reg, Expression::varOf(queue.pop)),
+		}));
+
+	} else if (net.purpose == flow::Net::Purpose::IN) {
 		channel.valid = mod.pushNet(net.name+"_valid", wire, clocked::Net::Purpose::IN);
 		channel.ready = mod.pushNet(net.name+"_ready", wire, clocked::Net::Purpose::OUT);
 		channel.data = mod.pushNet(net.name+"_data", synthesizeChannelType(net.type), clocked::Net::Purpose::IN);
 
+	} else if (net.purpose == flow::Net::Purpose::OUT and net.protocol == flow::Net::Protocol::CREDIT) {
+		// Branches toggle put to send a token, which stays on valid for the
+		// one cycle it takes sent to catch up. The receiver buffers every
+		// token, so this ignores the net's buffering. Credits count the
+		// receiver's free slots, less the token currently on valid.
+		size_t put = mod.pushNet(net.name+"_put", clocked::Type(clocked::Type::TypeName::FIXED, 1), clocked::Net::Purpose::REG);
+		always.reset.push_back(clocked::Assign(put, Expression::intOf(0)));
+		size_t sent = mod.pushNet(net.name+"_sent", clocked::Type(clocked::Type::TypeName::FIXED, 1), clocked::Net::Purpose::REG);
+		channel.valid = mod.pushNet(net.name+"_valid", wire, clocked::Net::Purpose::OUT);
+		mod.assign.push_back(clocked::Assign(channel.valid, Expression::varOf(put) ^ Expression::varOf(sent), true));
+
+		size_t data = mod.pushNet(net.name+"_data", synthesizeChannelType(net.type), clocked::Net::Purpose::OUT);
+		channel.data = mod.pushNet(net.name+"_state", synthesizeChannelType(net.type), clocked::Net::Purpose::REG);
+		mod.assign.push_back(clocked::Assign(data, Expression::varOf(channel.data), true));
+		if (resetData) {
+			always.reset.push_back(clocked::Assign(channel.data, Expression::intOf(0)));
+		}
+
+		size_t credit = mod.pushNet(net.name+"_credit", wire, clocked::Net::Purpose::IN);
+		size_t credits = mod.pushNet(net.name+"_credits", clocked::Type(clocked::Type::TypeName::FIXED, std::bit_width((unsigned)std::max(net.credits, 1))), clocked::Net::Purpose::REG);
+		channel.ready = mod.pushNet(net.name+"_enable", wire, clocked::Net::Purpose::WIRE);
+		mod.assign.push_back(clocked::Assign(channel.ready, arithmetic::ident(
+						Expression::varOf(credits) > Expression::varOf(channel.valid)), true));
+
+		mod.blocks.push_back(clocked::Block(Expression::varOf(mod.clk)));
+		clocked::Block &counter = mod.blocks.back();
+		counter.reset.push_back(clocked::Assign(sent, Expression::intOf(0)));
+		counter.reset.push_back(clocked::Assign(credits, Expression::intOf(std::max(net.credits, 1))));
+		counter.rules.push_back(clocked::Rule({
+			clocked::Assign(sent, Expression::varOf(put)),
+			clocked::Assign(credits, Expression::varOf(credits) + Expression::varOf(credit) - Expression::varOf(channel.valid)),
+		}));
+
+	} else if (net.purpose == flow::Net::Purpose::OUT and net.queueDepth() > 0) {
+		// The branches write the output register, which is handed to the
+		// queue whenever it has space. Branches own put and the queue owns
+		// take, so the register is pending while they differ.
+		size_t put = mod.pushNet(net.name+"_put", clocked::Type(clocked::Type::TypeName::FIXED, 1), clocked::Net::Purpose::REG);
+		always.reset.push_back(clocked::Assign(put, Expression::intOf(0)));
+		size_t take = mod.pushNet(net.name+"_take", clocked::Type(clocked::Type::TypeName::FIXED, 1), clocked::Net::Purpose::REG);
+		channel.valid = mod.pushNet(net.name+"_pending", wire, clocked::Net::Purpose::WIRE);
+		mod.assign.push_back(clocked::Assign(channel.valid, Expression::varOf(put) ^ Expression::varOf(take), true));
+
+		channel.data = mod.pushNet(net.name+"_state", synthesizeChannelType(net.type), clocked::Net::Purpose::REG);
+		if (resetData) {
+			always.reset.push_back(clocked::Assign(channel.data, Expression::intOf(0)));
+		}
+
+		size_t valid_wire = mod.pushNet(net.name+"_valid", wire, clocked::Net::Purpose::OUT);
+		size_t ready = mod.pushNet(net.name+"_ready", wire, clocked::Net::Purpose::IN);
+		size_t data = mod.pushNet(net.name+"_data", synthesizeChannelType(net.type), clocked::Net::Purpose::OUT);
+
+		// always is invalidated once the queue adds its block
+		QueueNets queue = synthesizeQueue(mod, net.name+"_queue", synthesizeChannelType(net.type), net.queueDepth(),
+			Expression::varOf(channel.valid), Expression::varOf(channel.data), Expression::varOf(ready), resetData);
+		channel.ready = queue.space;
+		mod.assign.push_back(clocked::Assign(valid_wire, Expression::varOf(queue.valid), true));
+		mod.assign.push_back(clocked::Assign(data, Expression::varOf(queue.data), true));
+
+		size_t enable = mod.pushNet(net.name+"_enable", wire, clocked::Net::Purpose::WIRE);
+		mod.assign.push_back(clocked::Assign(enable, arithmetic::ident(
+						!Expression::varOf(channel.valid) || Expression::varOf(channel.ready)), true));
+
+		clocked::Block &drain = mod.blocks.back();
+		drain.reset.push_back(clocked::Assign(take, Expression::intOf(0)));
+		drain.rules.push_back(clocked::Rule({
+			clocked::Assign(take, ~Expression::varOf(take)),
+		}, Expression::varOf(queue.push)));
+
 	} else if (net.purpose == flow::Net::Purpose::OUT) {
 		size_t valid_wire = mod.pushNet(net.name+"_valid", wire, clocked::Net::Purpose::OUT);
 		size_t valid_reg = mod.pushNet(net.name+"_valid_reg", clocked::Type(clocked::Type::TypeName::FIXED, 1), clocked::Net::Purpose::REG);
@@ -216,7 +408,9 @@ void synthesizeChannel(clocked::Module &mod, const Net &net) {
 		size_t data = mod.pushNet(net.name+"_data", synthesizeChannelType(net.type), clocked::Net::Purpose::OUT);
 		channel.data = mod.pushNet(net.name+"_state", synthesizeChannelType(net.type), clocked::Net::Purpose::REG);
 		mod.assign.push_back(clocked::Assign(data, Expression::varOf(channel.data), true));
-		always.reset.push_back(clocked::Assign(channel.data, Expression::intOf(0)));
+		if (resetData) {
+			always.reset.push_back(clocked::Assign(channel.data, Expression::intOf(0)));
+		}
 
 		size_t enable = mod.pushNet(net.name+"_enable", wire, clocked::Net::Purpose::WIRE);
 		mod.assign.push_back(clocked::Assign(enable, arithmetic::ident(
@@ -226,6 +420,7 @@ void synthesizeChannel(clocked::Module &mod, const Net &net) {
 		channel.valid = -1;  //mod.pushNet(net.name+"_valid", wire, clocked::Net::Purpose::WIRE);
 		channel.ready = -1;  //TODO: these could be wires for debug or mere modelling in cocotb harness
 		channel.data = mod.pushNet(net.name+"_data", synthesizeChannelType(net.type), clocked::Net::Purpose::REG);
+		// the Func reads this before writing it, so it always starts at 0
 		always.reset.push_back(clocked::Assign(channel.data, Expression::intOf(0)));
 
 	//TODO: migrate out of synthesizeChannel(), into synthesizeModuleFromFunc(), if/when COND's are no longer detected in netlist?
@@ -236,19 +431,457 @@ void synthesizeChannel(clocked::Module &mod, const Net &net) {
 	mod.chans.push_back(channel);
 }
 
+// Nets the branches write to send a token into a pipeline
+struct PipelineNets {
+	int put;
+	int sel;
+	// stage 0 registers for each Condition, by cond index
+	map<int, vector<int> > entry;
+};
+
+// Output channel fed by a pipeline. Branches evaluate stage 0 of their
+// expression into the entry registers, tag it with the Condition in sel,
+// and toggle put. Each later stage evaluates the next slice of that
+// Condition's expression and moves on once the stage after it has room.
+// The last stage is the output register. stages holds the
+// pipelineExpression() of every Condition writing the net.
+PipelineNets synthesizePipeline(clocked::Module &mod, const Net &net, const map<int, vector<vector<Expression> > > &stages, const vector<Range> &ranges, size_t condCount, bool resetData) {
+	static const clocked::Type wire(clocked::Type::TypeName::BITS, 1);
+	static const clocked::Type bit(clocked::Type::TypeName::FIXED, 1);
+	clocked::Type selType(clocked::Type::TypeName::FIXED, log2i(condCount));
+	clocked::Channel channel;
+	clocked::Block &always = mod.blocks.front();
+	int count = (int)stages.begin()->second.size();
+	PipelineNets result;
+
+	// Registers between stages s and s+1, sized by what each value needs
+	vector<int> sel;
+	vector<map<int, vector<int> > > regs(count-1);
+	map<int, vector<Range> > valueRanges;
+	for (int s = 0; s < count-1; s++) {
+		string prefix = net.name+"_p"+::to_string(s);
+		sel.push_back(mod.pushNet(prefix+"_sel", selType, clocked::Net::Purpose::REG));
+		for (auto cond = stages.begin(); cond != stages.end(); cond++) {
+			vector<Range> values;
+			for (int k = 0; k < (int)cond->second[s].size(); k++) {
+				Range range = inferRange(cond->second[s][k], s == 0 ? ranges : valueRanges[cond->first]);
+				values.push_back(range);
+				regs[s][cond->first].push_back(mod.pushNet(prefix+"_c"+::to_string(cond->first)+"_"+::to_string(k),
+					clocked::Type(clocked::Type::TypeName::FIXED, range.isKnown() ? range.width : 64), clocked::Net::Purpose::REG));
+			}
+			valueRanges[cond->first] = values;
+		}
+	}
+	result.sel = sel[0];
+	result.entry = regs[0];
+
+	result.put = mod.pushNet(net.name+"_put", bit, clocked::Net::Purpose::REG);
+	size_t take = mod.pushNet(net.name+"_take", bit, clocked::Net::Purpose::REG);
+	channel.valid = mod.pushNet(net.name+"_pending", wire, clocked::Net::Purpose::WIRE);
+	mod.assign.push_back(clocked::Assign(channel.valid, Expression::varOf(result.put) ^ Expression::varOf(take), true));
+	always.reset.push_back(clocked::Assign(result.put, Expression::intOf(0)));
+	always.reset.push_back(clocked::Assign(result.sel, Expression::intOf(0)));
+	for (auto cond = result.entry.begin(); resetData and cond != result.entry.end(); cond++) {
+		for (auto reg = cond->second.begin(); reg != cond->second.end(); reg++) {
+			always.reset.push_back(clocked::Assign(*reg, Expression::intOf(0)));
+		}
+	}
+
+	size_t valid_wire = mod.pushNet(net.name+"_valid", wire, clocked::Net::Purpose::OUT);
+	size_t valid_reg = mod.pushNet(net.name+"_valid_reg", bit, clocked::Net::Purpose::REG);
+	mod.assign.push_back(clocked::Assign(valid_wire, Expression::varOf(valid_reg), true));
+	size_t ready = mod.pushNet(net.name+"_ready", wire, clocked::Net::Purpose::IN);
+	size_t data = mod.pushNet(net.name+"_data", synthesizeChannelType(net.type), clocked::Net::Purpose::OUT);
+	channel.data = mod.pushNet(net.name+"_state", synthesizeChannelType(net.type), clocked::Net::Purpose::REG);
+	mod.assign.push_back(clocked::Assign(data, Expression::varOf(channel.data), true));
+
+	// full[s] holds a token, open[s] can take one this cycle
+	vector<int> full(count, -1), open(count, -1), load(count, -1);
+	full[0] = channel.valid;
+	for (int s = 1; s < count-1; s++) {
+		full[s] = mod.pushNet(net.name+"_p"+::to_string(s)+"_valid", bit, clocked::Net::Purpose::REG);
+	}
+	full[count-1] = valid_reg;
+	for (int s = count-1; s > 0; s--) {
+		open[s] = mod.pushNet(net.name+"_p"+::to_string(s)+"_open", wire, clocked::Net::Purpose::WIRE);
+		Expression next = s == count-1 ? Expression::varOf(ready) : Expression::varOf(open[s+1]);
+		mod.assign.push_back(clocked::Assign(open[s], arithmetic::ident(~Expression::varOf(full[s]) || next), true));
+	}
+	for (int s = 1; s < count; s++) {
+		load[s] = mod.pushNet(net.name+"_p"+::to_string(s)+"_load", wire, clocked::Net::Purpose::WIRE);
+		mod.assign.push_back(clocked::Assign(load[s], Expression::varOf(full[s-1]) && Expression::varOf(open[s]), true));
+	}
 
-set<size_t> getNetsInExpression(const Expression &e) {
-	set<size_t> nets;
-	for (const arithmetic::Operand &operand : e.exprIndex()) {
-		if (operand.type == arithmetic::Operand::Type::VAR) {
-			nets.insert(operand.index);
+	channel.ready = open[1];
+	size_t enable = mod.pushNet(net.name+"_enable", wire, clocked::Net::Purpose::WIRE);
+	mod.assign.push_back(clocked::Assign(enable, arithmetic::ident(
+					!Expression::varOf(channel.valid) || Expression::varOf(channel.ready)), true));
+
+	mod.blocks.push_back(clocked::Block(Expression::varOf(mod.clk)));
+	clocked::Block &pipe = mod.blocks.back();
+	pipe.reset.push_back(clocked::Assign(take, Expression::intOf(0)));
+	pipe.reset.push_back(clocked::Assign(valid_reg, Expression::intOf(0)));
+	if (resetData) {
+		pipe.reset.push_back(clocked::Assign(channel.data, Expression::intOf(0)));
+	}
+	for (int s = 1; s < count-1; s++) {
+		pipe.reset.push_back(clocked::Assign(full[s], Expression::intOf(0)));
+		pipe.reset.push_back(clocked::Assign(sel[s], Expression::intOf(0)));
+		for (auto cond = regs[s].begin(); resetData and cond != regs[s].end(); cond++) {
+			for (auto reg = cond->second.begin(); reg != cond->second.end(); reg++) {
+				pipe.reset.push_back(clocked::Assign(*reg, Expression::intOf(0)));
+			}
 		}
 	}
-	return nets;
+
+	pipe.rules.push_back(clocked::Rule({
+		clocked::Assign(take, ~Expression::varOf(take)),
+	}, Expression::varOf(load[1])));
+
+	for (int s = 1; s < count; s++) {
+		for (auto cond = stages.begin(); cond != stages.end(); cond++) {
+			Mapping<size_t> previous(-1, false);
+			for (int k = 0; k < (int)regs[s-1][cond->first].size(); k++) {
+				previous.set(k, regs[s-1][cond->first][k]);
+			}
+
+			clocked::Rule stage_rule;
+			stage_rule.guard = Expression::varOf(load[s]) && (Expression::varOf(sel[s-1]) == Expression::intOf(cond->first));
+			for (int k = 0; k < (int)cond->second[s].size(); k++) {
+				Expression value = cond->second[s][k];
+				value.applyVars(previous);
+				stage_rule.assign.push_back(clocked::Assign(s < count-1 ? regs[s][cond->first][k] : channel.data, value));
+			}
+			pipe.rules.push_back(stage_rule);
+		}
+
+		clocked::Rule advance({
+			clocked::Assign(full[s], Expression::intOf(1)),
+		}, Expression::varOf(load[s]));
+		if (s < count-1) {
+			advance.assign.push_back(clocked::Assign(sel[s], Expression::varOf(sel[s-1])));
+		}
+		pipe.rules.push_back(advance);
+
+		Expression next = s == count-1 ? Expression::varOf(ready) : Expression::varOf(open[s+1]);
+		pipe.rules.push_back(clocked::Rule({
+			clocked::Assign(full[s], Expression::intOf(0)),
+		}, ~Expression::varOf(load[s]) && next));
+	}
+
+	mod.chans.push_back(channel);
+	return result;
 }
 
+bool isShareable(const Operation &operation) {
+	switch (operation.func) {
+		case Operation::OpType::ADD:
+		case Operation::OpType::SUBTRACT:
+		case Operation::OpType::MULTIPLY:
+		case Operation::OpType::DIVIDE:
+		case Operation::OpType::MOD:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// What synthesizing one Condition produces
+struct Branch {
+	clocked::Rule rule;
+	// which assigns of rule compute a value, as opposed to handshakes
+	vector<bool> values;
+	Expression ready;
+};
+
+// An operator that the branches bound to it take turns on, see
+// shareOperators()
+struct SharedUnit {
+	int func;
+	int arity;
+	int width;
+	// shareable operators between this one and the leaves, plus one
+	int height;
+	// bound branches in Condition order, and the operands each feeds in
+	vector<int> branches;
+	map<int, vector<Operand> > inputs;
+	// shared_<id>, which names its operand wires too, -1 if unshared
+	int id;
+	int net;
+};
+
+bool areSameOperand(const Operand &a, const Operand &b) {
+	if (a.isConst() and b.isConst()) {
+		return a.cnst.type == b.cnst.type and a.cnst.ival == b.cnst.ival and a.cnst.rval == b.cnst.rval;
+	}
+	return a.isConst() == b.isConst() and a.isVar() == b.isVar() and a.isExpr() == b.isExpr() and a.index == b.index;
+}
+
+// Bind the arithmetic operators of exclusive branches to shared units.
+// Only one of a set of exclusive branches fires in a cycle, so operators
+// of the same kind and width in each of them can be computed by one unit
+// whose operands are muxed by which branch fires. Every branch gets at
+// most one operator of a unit, and units only take operators at the same
+// height, so a unit never feeds itself through another. Operators left
+// alone in their unit stay where they were.
+void shareOperators(clocked::Module &mod, const Func &func, vector<Branch> &branches) {
+	static const clocked::Type wire(clocked::Type::TypeName::BITS, 1);
+
+	vector<Range> ranges;
+	for (auto net = mod.nets.begin(); net != mod.nets.end(); net++) {
+		ranges.push_back(Range::ofWidth(net->type.width));
+	}
+	auto pushWire = [&](string name, const Expression &value) {
+		Range range = inferRange(value, ranges);
+		int width = range.isKnown() ? range.width : 64;
+		int net = mod.pushNet(name, clocked::Type(clocked::Type::TypeName::FIXED, width), clocked::Net::Purpose::WIRE);
+		ranges.push_back(Range::ofWidth(width));
+		mod.assign.push_back(clocked::Assign(net, value, true));
+		return net;
+	};
+
+	int n = (int)branches.size();
+	vector<vector<int> > exclusive(n, vector<int>(n, -1));
+	auto areExclusiveConds = [&](int i, int j) {
+		if (exclusive[i][j] < 0) {
+			exclusive[i][j] = exclusive[j][i] = areExclusive(func.conds[i].valid, func.conds[j].valid);
+		}
+		return exclusive[i][j] == 1;
+	};
+
+	// Bind operators in Condition order, each to the first unit of its kind
+	// that has no operator of this branch yet and whose branches are all
+	// exclusive with it. binding is by branch, assign and exprIndex.
+	vector<SharedUnit> units;
+	map<std::tuple<int, int, int, int>, vector<int> > kinds;
+	map<std::tuple<int, int, size_t>, int> binding;
+	for (int b = 0; b < n; b++) {
+		const clocked::Rule &rule = branches[b].rule;
+		for (int i = 0; i < (int)rule.assign.size(); i++) {
+			const Expression &e = rule.assign[i].expr;
+			if (not branches[b].values[i] or not e.top.isExpr()) {
+				continue;
+			}
+
+			map<size_t, int> heights;
+			for (arithmetic::PostOrderDFSIterator operation_it(e.sub, {e.top}); !operation_it.done(); ++operation_it) {
+				int height = 0;
+				for (auto operand = operation_it->operands.begin(); operand != operation_it->operands.end(); operand++) {
+					if (operand->isExpr()) {
+						height = std::max(height, heights[operand->index]);
+					}
+				}
+				if (isShareable(*operation_it)) {
+					height++;
+					Expression value = e;
+					value.top = Operand::exprOf(operation_it->exprIndex);
+					Range range = inferRange(value, ranges);
+					std::tuple<int, int, int, int> kind(operation_it->func, (int)operation_it->operands.size(), range.isKnown() ? range.width : 64, height);
+
+					vector<int> &candidates = kinds[kind];
+					int unit = -1;
+					for (auto u = candidates.begin(); unit < 0 and u != candidates.end(); u++) {
+						bool fits = true;
+						for (auto other = units[*u].branches.begin(); fits and other != units[*u].branches.end(); other++) {
+							fits = *other != b and areExclusiveConds(*other, b);
+						}
+						if (fits) {
+							unit = *u;
+						}
+					}
+					if (unit < 0) {
+						unit = (int)units.size();
+						candidates.push_back(unit);
+						units.push_back(SharedUnit{std::get<0>(kind), std::get<1>(kind), std::get<2>(kind), height, {}, {}, -1, -1});
+					}
+					units[unit].branches.push_back(b);
+					binding[{b, i, operation_it->exprIndex}] = unit;
+				}
+				heights[operation_it->exprIndex] = height;
+			}
+		}
+	}
+
+	int shared = 0;
+	for (auto unit = units.begin(); unit != units.end(); unit++) {
+		if (unit->branches.size() > 1) {
+			unit->id = shared++;
+			unit->net = mod.pushNet("shared_"+::to_string(unit->id),
+				clocked::Type(clocked::Type::TypeName::FIXED, unit->width), clocked::Net::Purpose::WIRE);
+			ranges.push_back(Range::ofWidth(unit->width));
+		}
+	}
+	if (shared == 0) {
+		return;
+	}
+
+	// Read every bound operator's operands, which by then only refer to
+	// the units below it, and read the unit instead
+	for (int b = 0; b < n; b++) {
+		clocked::Rule &rule = branches[b].rule;
+		for (int i = 0; i < (int)rule.assign.size(); i++) {
+			const Expression &e = rule.assign[i].expr;
+			if (not branches[b].values[i] or not e.top.isExpr()) {
+				continue;
+			}
+
+			Expression result = e;
+			bool changed = false;
+			for (arithmetic::PostOrderDFSIterator operation_it(e.sub, {e.top}); !operation_it.done(); ++operation_it) {
+				auto bound = binding.find({b, i, operation_it->exprIndex});
+				if (bound == binding.end() or units[bound->second].net < 0) {
+					continue;
+				}
+				SharedUnit &unit = units[bound->second];
+				string name = "shared_"+::to_string(unit.id)+"_b"+::to_string(b)+"_";
+
+				vector<Operand> &inputs = unit.inputs[b];
+				const Operation &operation = *result.getExpr(operation_it->exprIndex);
+				for (int k = 0; k < (int)operation.operands.size(); k++) {
+					Expression value = result;
+					value.top = operation.operands[k];
+					value.minimize();
+					if (value.top.isExpr()) {
+						value.top = Operand::varOf(pushWire(name+::to_string(k), value));
+					}
+					inputs.push_back(value.top);
+				}
+
+				Operation substitution(Operation::OpType::IDENTITY, {Operand::varOf(unit.net)});
+				substitution.exprIndex = operation_it->exprIndex;
+				result.sub.setExpr(substitution);
+				changed = true;
+			}
+
+			if (changed) {
+				result.minimize();
+				rule.assign[i].expr = result;
+			}
+		}
+	}
+
+	// Mux each operand by which branch fires, the last branch is the default
+	vector<int> fires(n, -1);
+	for (auto unit = units.begin(); unit != units.end(); unit++) {
+		if (unit->net < 0) {
+			continue;
+		}
+
+		Expression value;
+		vector<Operand> operands;
+		for (int k = 0; k < unit->arity; k++) {
+			Operand operand = unit->inputs[unit->branches.back()][k];
+			bool same = true;
+			for (auto b = unit->branches.begin(); same and b != unit->branches.end(); b++) {
+				same = areSameOperand(unit->inputs[*b][k], operand);
+			}
+			for (int j = (int)unit->branches.size()-2; not same and j >= 0; j--) {
+				int b = unit->branches[j];
+				if (fires[b] < 0) {
+					fires[b] = pushWire("branch_"+::to_string(b)+"_fire", branches[b].rule.guard);
+				}
+				operand = value.sub.pushExpr(Operation(Operation::OpType::TERNARY, {Operand::varOf(fires[b]), unit->inputs[b][k], operand}));
+			}
+			operands.push_back(operand);
+		}
+		value.top = value.sub.pushExpr(Operation((Operation::OpType)unit->func, operands));
+		mod.assign.push_back(clocked::Assign(unit->net, value, true));
+	}
+}
+
+// Performance counters and their scan chain, see
+// SynthesisOptions::perfCounters. fires holds the guard of each branch.
+void synthesizePerfCounters(clocked::Module &mod, const Func &func, const vector<Expression> &fires, int width) {
+	static const clocked::Type wire(clocked::Type::TypeName::BITS, 1);
+	clocked::Type counterType(clocked::Type::TypeName::FIXED, std::max(width, 1));
+
+	// What each counter counts, in scan order
+	vector<pair<string, Expression> > events;
+	for (size_t netIdx = 0; netIdx < func.nets.size(); netIdx++) {
+		const Net &net = func.nets[netIdx];
+		if (net.purpose != Net::Purpose::IN and net.purpose != Net::Purpose::OUT) {
+			continue;
+		}
+
+		// Count the handshake on the ports, chans holds the internal one for
+		// buffered and credit channels
+		Expression valid = Expression::varOf(mod.netIndex(net.name+"_valid"));
+		if (net.protocol == Net::Protocol::CREDIT) {
+			// every token on valid is taken, so credits stand in for stalls
+			events.push_back({net.name+"_credit", Expression::varOf(mod.netIndex(net.name+"_credit"))});
+			events.push_back({net.name+"_idle", ~valid});
+			events.push_back({net.name+"_xfer", valid});
+			continue;
+		}
+
+		Expression ready = Expression::varOf(mod.netIndex(net.name+"_ready"));
+		events.push_back({net.name+"_stall", valid && ~ready});
+		if (net.purpose == Net::Purpose::IN) {
+			// inputs are only acknowledged once they are valid, so idle
+			// counts the cycles without a token
+			events.push_back({net.name+"_idle", ~valid});
+		} else {
+			events.push_back({net.name+"_idle", ready && ~valid});
+		}
+		events.push_back({net.name+"_xfer", valid && ready});
+	}
+	for (size_t condIdx = 0; condIdx < fires.size(); condIdx++) {
+		events.push_back({"branch_"+::to_string(condIdx)+"_fires", fires[condIdx]});
+	}
+
+	size_t scan = mod.pushNet("perf_scan", wire, clocked::Net::Purpose::IN);
+	size_t scanIn = mod.pushNet("perf_scan_in", counterType, clocked::Net::Purpose::IN);
+	size_t scanOut = mod.pushNet("perf_scan_out", counterType, clocked::Net::Purpose::OUT);
+
+	mod.blocks.push_back(clocked::Block(Expression::varOf(mod.clk)));
+	clocked::Block &counters = mod.blocks.back();
+
+	// Counting stops while scanning, so the words read out are a snapshot
+	Expression shift = Expression::varOf(scan);
+	size_t prev = scanIn;
+	for (auto event = events.begin(); event != events.end(); event++) {
+		size_t counter = mod.pushNet("perf_"+event->first, counterType, clocked::Net::Purpose::REG);
+		counters.reset.push_back(clocked::Assign(counter, Expression::intOf(0)));
+
+		Expression count = ~shift && event->second;
+		count.minimize();
+		counters.rules.push_back(clocked::Rule({
+			clocked::Assign(counter, Expression::varOf(counter) + Expression::intOf(1)),
+		}, count));
+		counters.rules.push_back(clocked::Rule({
+			clocked::Assign(counter, Expression::varOf(prev)),
+		}, shift));
+		prev = counter;
+	}
+	mod.assign.push_back(clocked::Assign(scanOut, Expression::varOf(prev), true));
+}
 
 clocked::Module synthesizeModuleFromFunc(const Func &func, bool debug) {
+	return synthesizeModuleFromFunc(func, SynthesisOptions(), debug);
+}
+
+clocked::Module synthesizeModuleFromFunc(const Func &func, const SynthesisOptions &options, bool debug) {
+	if (debug) {
+		PrintTrace sink;
+		Tracer trace(&sink);
+		return synthesizeModuleFromFunc(func, options, trace);
+	}
+	NoTrace trace;
+	return synthesizeModuleFromFunc(func, options, trace);
+}
+
+template <typename Trace>
+clocked::Module synthesizeModuleFromFunc(const Func &func, const SynthesisOptions &options, Trace &trace) {
+	if (options.strengthReduction) {
+		Func lowered = func;
+		reduceStrength(lowered);
+		foldRegisterShifts(lowered);
+
+		SynthesisOptions rest = options;
+		rest.strengthReduction = false;
+		return synthesizeModuleFromFunc(lowered, rest, trace);
+	}
+
 	clocked::Module mod;
 	mod.name = func.name;
 
@@ -257,7 +890,6 @@ clocked::Module synthesizeModuleFromFunc(const Func &func, bool debug) {
 
 	clocked::Block setupBlock(Expression::varOf(mod.clk));
 	mod.blocks.push_back(setupBlock);
-	clocked::Block &always = mod.blocks.back();
 
 	// Map flow nets to valid-ready channels
 	Mapping<size_t> funcNetToChannelData(-1, true);
@@ -265,15 +897,63 @@ clocked::Module synthesizeModuleFromFunc(const Func &func, bool debug) {
 	Mapping<size_t> funcNetToChannelReady(-1, true);
 	//TODO: set<size_t> internalRegisters; ???
 
+	// Outputs with expressions too deep for one cycle, by net and then by
+	// cond index. Buffered and credit outputs are left alone.
+	map<int, map<int, vector<vector<Expression> > > > pipelines;
+	if (options.pipelineDepth > 0) {
+		map<int, int> stages;
+		for (auto condIt = func.conds.begin(); condIt != func.conds.end(); condIt++) {
+			for (auto condOutputIt = condIt->outs.begin(); condOutputIt != condIt->outs.end(); condOutputIt++) {
+				const Net &net = func.nets[condOutputIt->first];
+				if (net.purpose == flow::Net::Purpose::OUT and net.queueDepth() == 0 and net.protocol == flow::Net::Protocol::VALID_READY) {
+					Expression request = condOutputIt->second;
+					request.minimize();
+					stages[condOutputIt->first] = std::max(stages[condOutputIt->first], pipelineStages(request, options.pipelineDepth));
+				}
+			}
+		}
+
+		for (int condIdx = 0; condIdx < (int)func.conds.size(); condIdx++) {
+			const Condition &cond = func.conds[condIdx];
+			for (auto condOutputIt = cond.outs.begin(); condOutputIt != cond.outs.end(); condOutputIt++) {
+				auto net = stages.find(condOutputIt->first);
+				if (net != stages.end() and net->second > 1) {
+					Expression request = condOutputIt->second;
+					request.minimize();
+					pipelines[net->first][condIdx] = pipelineExpression(request, options.pipelineDepth, net->second);
+				}
+			}
+		}
+	}
+	vector<Range> ranges = pipelines.empty() ? vector<Range>() : inferRanges(func);
+
+	// Buffered, credit, and pipelined outputs signal a new token by toggling put
+	vector<int> channelPut(func.nets.size(), -1);
+	map<int, PipelineNets> pipelineNets;
+
 	for (size_t netIdx = 0; netIdx < func.nets.size(); netIdx++) {
-		synthesizeChannel(mod, func.nets[netIdx]);
+		auto pipeline = pipelines.find(netIdx);
+		if (pipeline != pipelines.end()) {
+			pipelineNets[netIdx] = synthesizePipeline(mod, func.nets[netIdx], pipeline->second, ranges, func.conds.size(), options.resetDatapath);
+			channelPut[netIdx] = pipelineNets[netIdx].put;
+		} else {
+			synthesizeChannel(mod, func.nets[netIdx], options.resetDatapath);
+		}
 
 		// Map flow::Func nets to clocked::Channel nets
 		funcNetToChannelData.set(netIdx, mod.chans[netIdx].data);
 		funcNetToChannelValid.set(netIdx, mod.chans[netIdx].valid);
 		funcNetToChannelReady.set(netIdx, mod.chans[netIdx].ready);
+		trace.net(netIdx, mod.chans[netIdx].data, mod.chans[netIdx].valid, mod.chans[netIdx].ready);
+		if (func.nets[netIdx].purpose == flow::Net::Purpose::OUT
+			and (func.nets[netIdx].queueDepth() > 0 or func.nets[netIdx].protocol == flow::Net::Protocol::CREDIT)) {
+			channelPut[netIdx] = mod.netIndex(func.nets[netIdx].name+"_put");
+		}
 	}
 
+	// Buffered channels add blocks of their own, the branches live in the first
+	clocked::Block &always = mod.blocks.front();
+
 	// Track branch selection for conditional execution
 	size_t branch_id_width = log2i(func.conds.size());
 	size_t branch_id_reg = mod.pushNet("branch_id",
@@ -281,13 +961,25 @@ clocked::Module synthesizeModuleFromFunc(const Func &func, bool debug) {
 		clocked::Net::Purpose::REG);
 	always.reset.push_back(clocked::Assign(branch_id_reg, Expression::intOf(0)));
 
-	size_t branch_id = 0;
-	for (auto condIt = func.conds.begin(); condIt != func.conds.end(); ++condIt) {
-		clocked::Rule branch_rule;
-		branch_rule.assign.push_back(clocked::Assign(branch_id_reg, Expression::intOf(branch_id)));
-
-		Expression predicate = condIt->valid;
-		predicate.minimize();
+	// Guard of each branch, for the performance counters
+	vector<Expression> fires(func.conds.size());
+
+	// Each Condition's branch only reads the nets set up above, so they are
+	// worked out in parallel and then merged in order. Operator sharing adds
+	// wires to the Module, so it waits for every branch.
+
+	auto synthesizeBranch = [&](size_t branch_id) {
+		const Condition &cond = func.conds[branch_id];
+		Branch result;
+		clocked::Rule &branch_rule = result.rule;
+		auto pushAssign = [&](size_t net, Expression expr, bool value) {
+			branch_rule.assign.push_back(clocked::Assign(net, expr));
+			result.values.push_back(value);
+		};
+		pushAssign(branch_id_reg, Expression::intOf(branch_id), false);
+
+		Expression predicate = cond.valid;
+		minimize(predicate, trace);
 		predicate.applyVars(funcNetToChannelData);
 		//predicate = synthesizeExpressionProbes(predicate, funcNetToChannelValid, funcNetToChannelData);
 
@@ -303,57 +995,74 @@ clocked::Module synthesizeModuleFromFunc(const Func &func, bool debug) {
 			//size_t func_net = funcNetToChannelData.unmap(net);  //decode mapping applied beforehand
 			size_t mod_valid_net = funcNetToChannelValid.map(net);
 			clocked_nets_that_branch_needs_to_be_valid.insert(mod_valid_net);
-			if (debug) { cout << "==(var in predicate expr)> " << mod_valid_net << endl; }
 		}
 
 		// only when all input channels, who need acknowledgement, are valid
-		for (auto condInputIt = condIt->ins.begin(); condInputIt != condIt->ins.end(); condInputIt++) {
+		for (auto condInputIt = cond.ins.begin(); condInputIt != cond.ins.end(); condInputIt++) {
 			size_t mod_valid_net = funcNetToChannelValid.map(*condInputIt);
 			clocked_nets_that_branch_needs_to_be_valid.insert(mod_valid_net); //TODO: must ack's be valid?
-			if (debug) { cout << "==(var to ack)> " << mod_valid_net << endl; }
 		}
 
-		for (auto condRegIt = condIt->regs.begin(); condRegIt != condIt->regs.end(); condRegIt++) {
+		for (auto condRegIt = cond.regs.begin(); condRegIt != cond.regs.end(); condRegIt++) {
 			Expression internalRegAssignment(condRegIt->second);
-			internalRegAssignment.minimize();
+			minimize(internalRegAssignment, trace);
 
 			// only when [input?] channels referenced in internal-memory assignments are valid
 			for (size_t net : getNetsInExpression(internalRegAssignment)) {
 				size_t mod_valid_net = funcNetToChannelValid.map(net);
 				clocked_nets_that_branch_needs_to_be_valid.insert(mod_valid_net);
-				if (debug) { cout << "==(var in mem expr)> " << mod_valid_net << endl; }
 			}
 
 			// Assign to internal-memory registers
 			size_t mod_data_net = funcNetToChannelData.map(condRegIt->first);
 			internalRegAssignment.applyVars(funcNetToChannelData); 
-			branch_rule.assign.push_back(clocked::Assign(mod_data_net, internalRegAssignment));
+			pushAssign(mod_data_net, internalRegAssignment, true);
 		}
 
-		for (auto condOutputIt = condIt->outs.begin(); condOutputIt != condIt->outs.end(); condOutputIt++) {
+		for (auto condOutputIt = cond.outs.begin(); condOutputIt != cond.outs.end(); condOutputIt++) {
 			Expression request = condOutputIt->second;
-			request.minimize();
+			minimize(request, trace);
 
 			//only when [input?] channels referenced in requests to be sent are valid
 			for (size_t net : getNetsInExpression(request)) {
 				size_t mod_valid_net = funcNetToChannelValid.map(net);
 				clocked_nets_that_branch_needs_to_be_valid.insert(mod_valid_net);
-				if (debug) { cout << "==(var in req expr)> " << mod_valid_net << endl; }
 			}
 
 			size_t mod_data_net = funcNetToChannelData.map(condOutputIt->first);
 
 			// Assign to outputs
-			request.applyVars(funcNetToChannelData);
-			branch_rule.assign.push_back(clocked::Assign(mod_data_net, request));
+			auto pipeline = pipelineNets.find(condOutputIt->first);
+			if (pipeline != pipelineNets.end()) {
+				// or to the first stage of their pipeline
+				const vector<Expression> &entry = pipelines.at(condOutputIt->first).at(branch_id)[0];
+				for (int k = 0; k < (int)entry.size(); k++) {
+					Expression value = entry[k];
+					value.applyVars(funcNetToChannelData);
+					pushAssign(pipeline->second.entry.at(branch_id)[k], value, true);
+				}
+				pushAssign(pipeline->second.sel, Expression::intOf(branch_id), false);
+			} else {
+				request.applyVars(funcNetToChannelData);
+				pushAssign(mod_data_net, request, true);
+			}
 
 			// only when all output channels are ready to be written to
 			size_t mod_valid_net = funcNetToChannelValid.map(condOutputIt->first);
 			if (mod_valid_net != funcNetToChannelValid.undef) {  // flow::Net::Purpose::REG don't have valid/ready signals over channel
-				branch_rule.assign.push_back(clocked::Assign(mod_valid_net, Expression::intOf(1)));
+				int put = channelPut[condOutputIt->first];
+				if (put >= 0) {
+					pushAssign(put, ~Expression::varOf(put), false);
+				} else {
+					pushAssign(mod_valid_net, Expression::intOf(1), false);
+				}
 
 				size_t mod_ready_net = funcNetToChannelReady.map(condOutputIt->first);
-				if (mod_ready_net != funcNetToChannelReady.undef) {  // flow::Net::Purpose::REG don't have valid/ready signals over channel
+				if (mod_ready_net != funcNetToChannelReady.undef  // flow::Net::Purpose::REG don't have valid/ready signals over channel
+					and func.nets[condOutputIt->first].protocol == flow::Net::Protocol::CREDIT) {
+					// credits already account for the token in flight
+					branch_ready = branch_ready && Expression::varOf(mod_ready_net);
+				} else if (mod_ready_net != funcNetToChannelReady.undef) {
 					branch_ready = branch_ready && (
 							~Expression::varOf(mod_valid_net)
 							|| Expression::varOf(mod_ready_net));
@@ -369,20 +1078,66 @@ clocked::Module synthesizeModuleFromFunc(const Func &func, bool debug) {
 			}
 		}
 
-		//TODO: prune this default value until a smarter minimize() handles this (see Expression tests)
-		if (branch_ready.size() > 1) { cout << " _<^>_<^>_<^>_<^>_<^>_<^> TODO: " << branch_ready.to_string(true) << endl; } //branch_ready.eraseExpr(0); }
-
 		branch_rule.guard = arithmetic::ident(predicate) && branch_ready;
-		branch_rule.guard.minimize();
-		always.rules.push_back(branch_rule);
+		minimize(branch_rule.guard, trace);
 
 		// Ensure only this branch executes until transaction is complete
 		Expression branch_selector = arithmetic::ident(Expression::varOf(branch_id_reg) == Expression::intOf(branch_id));
-		branch_ready = branch_selector && branch_ready;
-		branch_ready.minimize();
-		mod.assign.push_back(clocked::Assign(mod.chans[condIt->uid].ready, branch_ready, true));
+		result.ready = branch_selector && branch_ready;
+		minimize(result.ready, trace);
+		return result;
+	};
+
+	// Tracers aren't thread safe, so tracing keeps to one thread
+	vector<Branch> branches(func.conds.size());
+	int threads = Trace::enabled ? 1 : options.threads;
+	if (threads <= 0) {
+		threads = (int)std::thread::hardware_concurrency();
+	}
+	threads = std::max(std::min(threads, (int)func.conds.size()), 1);
+	if (threads == 1) {
+		for (size_t branch_id = 0; branch_id < branches.size(); branch_id++) {
+			branches[branch_id] = synthesizeBranch(branch_id);
+		}
+	} else {
+		vector<std::thread> workers;
+		for (int t = 0; t < threads; t++) {
+			workers.push_back(std::thread([&, t]() {
+				for (size_t branch_id = t; branch_id < branches.size(); branch_id += threads) {
+					branches[branch_id] = synthesizeBranch(branch_id);
+				}
+			}));
+		}
+		for (auto worker = workers.begin(); worker != workers.end(); worker++) {
+			worker->join();
+		}
+	}
+
+	if (options.shareOperators) {
+		shareOperators(mod, func, branches);
+	}
+
+	// With a profile, each rule is an else-if of the rules before it as
+	// long as it is exclusive with all of them, so the hot Conditions cut
+	// off the rest. Without one every rule is its own if.
+	vector<int> order = prioritizeConds(func, options.branchProfile);
+	vector<int> chain;
+	for (auto branch_id = order.begin(); branch_id != order.end(); branch_id++) {
+		Branch &branch = branches[*branch_id];
+		bool chained = not options.branchProfile.empty() and not chain.empty();
+		for (auto prev = chain.begin(); chained and prev != chain.end(); prev++) {
+			chained = areExclusive(func.conds[*prev].valid, func.conds[*branch_id].valid);
+		}
+		if (not chained) {
+			chain.clear();
+		}
+		chain.push_back(*branch_id);
 
-		branch_id++;
+		always.rules.push_back(branch.rule);
+		always.rules.back().isChained = chained;
+		trace.condition(*branch_id, branch.rule.guard);
+		fires[*branch_id] = branch.rule.guard;
+		mod.assign.push_back(clocked::Assign(mod.chans[func.conds[*branch_id].uid].ready, branch.ready, true));
 	}
 
 	// Return ready signals for each channel
@@ -409,7 +1164,36 @@ clocked::Module synthesizeModuleFromFunc(const Func &func, bool debug) {
 		}
 	}
 
+	if (options.perfCounters) {
+		synthesizePerfCounters(mod, func, fires, options.counterWidth);
+	}
+
 	return mod;
 }
 
+template clocked::Module synthesizeModuleFromFunc<NoTrace>(const Func &func, const SynthesisOptions &options, NoTrace &trace);
+template clocked::Module synthesizeModuleFromFunc<Tracer>(const Func &func, const SynthesisOptions &options, Tracer &trace);
+
+// Synthesize every Func of a Graph after dedupFuncs()
+vector<clocked::Module> synthesizeUniqueFuncs(const Graph &unique, const SynthesisOptions &options) {
+	vector<clocked::Module> mods;
+	for (auto func = unique.funcs.begin(); func != unique.funcs.end(); func++) {
+		mods.push_back(synthesizeModuleFromFunc(*func, options));
+	}
+	return mods;
+}
+
+vector<clocked::Module> synthesizeModulesFromGraph(const Graph &graph, vector<int> &nodes, const SynthesisOptions &options) {
+	Graph unique = graph;
+	unique.dedupFuncs();
+	nodes = unique.nodes;
+	return synthesizeUniqueFuncs(unique, options);
+}
+
+clocked::Module synthesizeModuleFromGraph(const Graph &graph, const SynthesisOptions &options, string name) {
+	Graph unique = graph;
+	unique.dedupFuncs();
+	return flattenGraph(unique, synthesizeUniqueFuncs(unique, options), name);
+}
+
 }
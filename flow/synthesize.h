@@ -1,13 +1,91 @@
 #pragma once
 
+#include <cstdint>
+
 #include "func.h"
+#include "graph.h"
 #include "module.h"
+#include "trace.h"
 
 namespace flow {
 
 clocked::Type synthesize_type(const flow::Type &type);
 void synthesize_chan(clocked::Module &mod, const flow::Net &net);
+
+struct SynthesisOptions {
+	SynthesisOptions();
+	~SynthesisOptions();
+
+	// Most operators evaluated in one cycle on the way to an output, 0 for
+	// no limit. Outputs whose expressions go deeper are computed by a
+	// pipeline of registers with its own valid/ready handshake between
+	// stages, adding a cycle of latency per stage.
+	int pipelineDepth;
+
+	// Bind the add, subtract, multiply, divide and mod operators of
+	// Conditions that can never fire together to shared units, one per
+	// kind and width, with the operands muxed by which branch fires. Trades
+	// a mux per operand for each operator saved. Off by default to keep the
+	// netlist one to one with the Func. See shareOperators().
+	bool shareOperators;
+
+	// Lower multiply, divide and mod by powers of two into shifts and masks,
+	// and store REGs whose writes are all shifted by a constant unshifted.
+	// See reduceStrength() and foldRegisterShifts().
+	bool strengthReduction;
+
+	// Reset the registers that only carry a token's data, like output and
+	// queue registers. Valid bits, branch_id and the Func's REG nets are
+	// always reset. Without a reset those registers start out as X until
+	// the first token arrives, sparing the reset net their fanout.
+	bool resetDatapath;
+
+	// Count what every channel and branch does, for profiling in hardware.
+	// Each IN and OUT net gets a stall, idle, and transfer counter of the
+	// handshake on its ports, and each Condition a counter of the cycles it
+	// fires, in that order. A credit channel has no ready, so it counts the
+	// cycles a credit is returned in place of stalls. Raising
+	// perf_scan freezes the counters into a shift register of counterWidth
+	// bit words from perf_scan_in to perf_scan_out, so chaining the scan
+	// ports of several Modules reads them all out over the same wires. Off
+	// by default, which adds no logic at all.
+	bool perfCounters;
+	int counterWidth;
+
+	// Threads that work out the branches of the Conditions, 0 for one per
+	// core. They are merged in Condition order, so the Module comes out the
+	// same however many there are.
+	int threads;
+
+	// How many times each Condition fired, indexed like func.conds, from a
+	// simulation of the Func or from the perfCounters of an earlier build.
+	// The rules of the Module are checked in that order, hottest first, and
+	// each one is chained as an else-if onto the rules before it while it
+	// is exclusive with all of them, so the colder guards aren't checked
+	// once a hot one fires. A Condition never passes one it isn't exclusive
+	// with, see prioritizeConds(). Empty keeps the Condition order and
+	// leaves every rule a separate if. branch_id and the counters are
+	// numbered by Condition either way.
+	vector<int64_t> branchProfile;
+};
+
+// debug prints what synthesis does through a PrintTrace
 clocked::Module synthesizeModuleFromFunc(const Func &func, bool debug=false);
+clocked::Module synthesizeModuleFromFunc(const Func &func, const SynthesisOptions &options, bool debug=false);
+
+// Reports to trace as it goes, see trace.h. Defined for NoTrace and Tracer.
+template <typename Trace>
+clocked::Module synthesizeModuleFromFunc(const Func &func, const SynthesisOptions &options, Trace &trace);
+
+// Synthesize each structurally distinct Func of the Graph exactly once, see
+// Graph::dedupFuncs(). The Graph is left as is, nodes is set to the index
+// of the Module each of graph.nodes uses.
+vector<clocked::Module> synthesizeModulesFromGraph(const Graph &graph, vector<int> &nodes, const SynthesisOptions &options=SynthesisOptions());
+// Synthesize the Graph into a single Module with every node inlined, see
+// flattenGraph()
+clocked::Module synthesizeModuleFromGraph(const Graph &graph, const SynthesisOptions &options=SynthesisOptions(), string name="top");
 arithmetic::Expression synthesizeExpressionProbes(const arithmetic::Expression &e, const Mapping<size_t> &ChannelToValid, const Mapping<size_t> &ChannelToData);
+template <typename Trace>
+arithmetic::Expression synthesizeExpressionProbes(const arithmetic::Expression &e, const Mapping<size_t> &ChannelToValid, const Mapping<size_t> &ChannelToData, Trace &trace);
 
 }
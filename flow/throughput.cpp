@@ -0,0 +1,374 @@
+#include "throughput.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace flow {
+
+static const double EPSILON = 1e-9;
+
+MarkedGraph::MarkedGraph() {
+	nodes = 0;
+}
+
+MarkedGraph::MarkedGraph(const Graph &graph, const vector<int> &depths) {
+	nodes = (int)graph.nodes.size();
+
+	vector<bool> isSource(nodes, false);
+	for (int node = 0; node < nodes; node++) {
+		const Func &func = graph.funcs[graph.nodes[node]];
+		isSource[node] = not func.conds.empty();
+		for (auto cond = func.conds.begin(); cond != func.conds.end(); cond++) {
+			isSource[node] = isSource[node] and cond->ins.empty();
+		}
+
+		edges.push_back({node, node, 1, 1, -1, false});
+	}
+
+	for (int arcIdx = 0; arcIdx < (int)graph.arcs.size(); arcIdx++) {
+		const Arc &arc = graph.arcs[arcIdx];
+		if (arc.from < 0 or arc.from >= nodes or arc.to < 0 or arc.to >= nodes) {
+			continue;
+		}
+
+		int capacity = 1;
+		int forward = 1, backward = 0;
+		const Func &producer = graph.funcs[graph.nodes[arc.from]];
+		if (arc.fromPort >= 0 and arc.fromPort < (int)producer.nets.size()) {
+			const Net &net = producer.nets[arc.fromPort];
+			if (net.protocol == Net::Protocol::CREDIT) {
+				// the receiver's queue holds every credit, and the credit
+				// takes a cycle to return and another to be counted
+				capacity = std::max(net.credits, 1);
+				forward = 2;
+				backward = 2;
+			} else if (net.queueDepth() > 0) {
+				// the queue sits behind the output register, tokens take an
+				// extra cycle to pass through but ready is registered
+				capacity = net.queueDepth()+1;
+				forward = 2;
+				backward = 1;
+			}
+		}
+
+		int depth = arcIdx < (int)depths.size() ? depths[arcIdx] : capacity;
+		if (not isSource[arc.to]) {
+			edges.push_back({arc.from, arc.to, forward, 0, arcIdx, false});
+		}
+		// with valid/ready and no queue, ready is combinational and a slot
+		// frees up the cycle it is consumed
+		edges.push_back({arc.to, arc.from, backward, depth, arcIdx, true});
+	}
+}
+
+MarkedGraph::~MarkedGraph() {
+}
+
+ThroughputReport::ThroughputReport() {
+	deadlock = false;
+	cycleRatio = 0.0;
+	throughput = std::numeric_limits<double>::infinity();
+}
+
+ThroughputReport::~ThroughputReport() {
+}
+
+// Out edges of each node, offset[n] to offset[n+1] in out
+void indexEdges(const MarkedGraph &mg, vector<int> &offset, vector<int> &out) {
+	offset.assign(mg.nodes+1, 0);
+	for (auto edge = mg.edges.begin(); edge != mg.edges.end(); edge++) {
+		offset[edge->from+1]++;
+	}
+	for (int node = 0; node < mg.nodes; node++) {
+		offset[node+1] += offset[node];
+	}
+
+	out.assign(mg.edges.size(), -1);
+	vector<int> cursor(offset.begin(), offset.end()-1);
+	for (int edgeIdx = 0; edgeIdx < (int)mg.edges.size(); edgeIdx++) {
+		out[cursor[mg.edges[edgeIdx].from]++] = edgeIdx;
+	}
+}
+
+// Depth first search restricted to places without tokens. Any cycle found
+// can never fire. Returns the edges along it, empty if there is none.
+vector<int> findTokenFreeCycle(const MarkedGraph &mg, const vector<int> &offset, const vector<int> &out) {
+	enum { WHITE, GRAY, BLACK };
+	vector<int> color(mg.nodes, WHITE);
+	vector<int> parent(mg.nodes, -1);
+	vector<pair<int, int> > stack;
+
+	for (int root = 0; root < mg.nodes; root++) {
+		if (color[root] != WHITE) {
+			continue;
+		}
+
+		color[root] = GRAY;
+		stack.push_back({root, offset[root]});
+		while (not stack.empty()) {
+			int node = stack.back().first;
+			int &next = stack.back().second;
+			if (next >= offset[node+1]) {
+				color[node] = BLACK;
+				stack.pop_back();
+				continue;
+			}
+
+			int edgeIdx = out[next++];
+			const MarkedGraph::Edge &edge = mg.edges[edgeIdx];
+			if (edge.tokens != 0) {
+				continue;
+			}
+
+			if (color[edge.to] == WHITE) {
+				color[edge.to] = GRAY;
+				parent[edge.to] = edgeIdx;
+				stack.push_back({edge.to, offset[edge.to]});
+			} else if (color[edge.to] == GRAY) {
+				vector<int> cycle = {edgeIdx};
+				for (int curr = node; curr != edge.to; curr = mg.edges[parent[curr]].from) {
+					cycle.push_back(parent[curr]);
+				}
+				std::reverse(cycle.begin(), cycle.end());
+				return cycle;
+			}
+		}
+	}
+	return vector<int>();
+}
+
+void reportCycle(const MarkedGraph &mg, const vector<int> &cycle, ThroughputReport &report) {
+	for (auto edgeIdx = cycle.begin(); edgeIdx != cycle.end(); edgeIdx++) {
+		const MarkedGraph::Edge &edge = mg.edges[*edgeIdx];
+		report.criticalNodes.push_back(edge.from);
+		if (edge.arc >= 0 and std::find(report.criticalArcs.begin(), report.criticalArcs.end(), edge.arc) == report.criticalArcs.end()) {
+			report.criticalArcs.push_back(edge.arc);
+		}
+	}
+}
+
+// Howard's policy iteration for the maximum cycle ratio. Every node keeps
+// one chosen out edge, the policy. Evaluating the policy gives each node
+// the ratio of the cycle its policy path ends in, eta, and a bias x
+// relative to that cycle. Nodes then switch to out edges that reach a
+// higher ratio, or failing that a higher bias, until nothing changes.
+ThroughputReport maxCycleRatio(const MarkedGraph &mg, vector<int> &cycle) {
+	ThroughputReport report;
+	cycle.clear();
+
+	vector<int> offset, out;
+	indexEdges(mg, offset, out);
+
+	cycle = findTokenFreeCycle(mg, offset, out);
+	if (not cycle.empty()) {
+		report.deadlock = true;
+		report.cycleRatio = std::numeric_limits<double>::infinity();
+		report.throughput = 0.0;
+		reportCycle(mg, cycle, report);
+		return report;
+	}
+
+	// Nodes that can't reach a cycle never matter, peel them off so that
+	// every remaining node has a policy
+	vector<bool> alive(mg.nodes, true);
+	vector<int> degree(mg.nodes, 0);
+	vector<vector<int> > preds(mg.nodes);
+	for (auto edge = mg.edges.begin(); edge != mg.edges.end(); edge++) {
+		degree[edge->from]++;
+		preds[edge->to].push_back(edge->from);
+	}
+	vector<int> worklist;
+	for (int node = 0; node < mg.nodes; node++) {
+		if (degree[node] == 0) {
+			worklist.push_back(node);
+		}
+	}
+	while (not worklist.empty()) {
+		int node = worklist.back();
+		worklist.pop_back();
+		alive[node] = false;
+		for (auto pred = preds[node].begin(); pred != preds[node].end(); pred++) {
+			if (--degree[*pred] == 0) {
+				worklist.push_back(*pred);
+			}
+		}
+	}
+
+	vector<int> policy(mg.nodes, -1);
+	for (int node = 0; node < mg.nodes; node++) {
+		for (int i = offset[node]; alive[node] and i < offset[node+1]; i++) {
+			const MarkedGraph::Edge &edge = mg.edges[out[i]];
+			if (alive[edge.to] and (policy[node] < 0 or edge.delay > mg.edges[policy[node]].delay)) {
+				policy[node] = out[i];
+			}
+		}
+	}
+
+	vector<double> eta(mg.nodes, 0.0);
+	vector<double> x(mg.nodes, 0.0);
+	vector<int> visited(mg.nodes, -1);
+	vector<int> path;
+	double best = -std::numeric_limits<double>::infinity();
+	int bestStart = -1;
+
+	int maxIterations = 100 + 10*mg.nodes;
+	for (int iteration = 0; iteration < maxIterations; iteration++) {
+		// Value determination
+		std::fill(visited.begin(), visited.end(), -1);
+		best = -std::numeric_limits<double>::infinity();
+		bestStart = -1;
+		for (int root = 0; root < mg.nodes; root++) {
+			if (not alive[root] or visited[root] >= 0) {
+				continue;
+			}
+
+			path.clear();
+			int node = root;
+			while (visited[node] < 0) {
+				visited[node] = root;
+				path.push_back(node);
+				node = mg.edges[policy[node]].to;
+			}
+
+			int tail = (int)path.size();
+			if (visited[node] == root) {
+				// This walk closed a new cycle at node
+				double delay = 0.0, tokens = 0.0;
+				int curr = node;
+				do {
+					const MarkedGraph::Edge &edge = mg.edges[policy[curr]];
+					delay += edge.delay;
+					tokens += edge.tokens;
+					curr = edge.to;
+				} while (curr != node);
+
+				double lambda = delay/tokens;
+				tail = (int)(std::find(path.begin(), path.end(), node) - path.begin());
+				eta[node] = lambda;
+				x[node] = 0.0;
+				for (int i = (int)path.size()-1; i > tail; i--) {
+					const MarkedGraph::Edge &edge = mg.edges[policy[path[i]]];
+					eta[path[i]] = lambda;
+					x[path[i]] = edge.delay - lambda*edge.tokens + x[edge.to];
+				}
+
+				if (lambda > best) {
+					best = lambda;
+					bestStart = node;
+				}
+			}
+
+			for (int i = tail-1; i >= 0; i--) {
+				const MarkedGraph::Edge &edge = mg.edges[policy[path[i]]];
+				eta[path[i]] = eta[edge.to];
+				x[path[i]] = edge.delay - eta[path[i]]*edge.tokens + x[edge.to];
+			}
+		}
+
+		// Policy improvement, first toward higher ratio cycles
+		bool changed = false;
+		for (int node = 0; node < mg.nodes; node++) {
+			for (int i = offset[node]; alive[node] and i < offset[node+1]; i++) {
+				const MarkedGraph::Edge &edge = mg.edges[out[i]];
+				if (alive[edge.to] and eta[edge.to] > eta[node] + EPSILON
+					and eta[edge.to] > eta[mg.edges[policy[node]].to] + EPSILON) {
+					policy[node] = out[i];
+					changed = true;
+				}
+			}
+		}
+
+		// then toward higher bias within the same ratio
+		if (not changed) {
+			for (int node = 0; node < mg.nodes; node++) {
+				double value = x[node];
+				for (int i = offset[node]; alive[node] and i < offset[node+1]; i++) {
+					const MarkedGraph::Edge &edge = mg.edges[out[i]];
+					if (not alive[edge.to] or std::abs(eta[edge.to] - eta[node]) > EPSILON) {
+						continue;
+					}
+
+					double next = edge.delay - eta[node]*edge.tokens + x[edge.to];
+					if (next > value + EPSILON) {
+						value = next;
+						policy[node] = out[i];
+						changed = true;
+					}
+				}
+			}
+		}
+
+		if (not changed) {
+			break;
+		}
+	}
+
+	if (bestStart < 0) {
+		// no cycles at all, nothing limits throughput
+		return report;
+	}
+
+	int curr = bestStart;
+	do {
+		cycle.push_back(policy[curr]);
+		curr = mg.edges[policy[curr]].to;
+	} while (curr != bestStart);
+
+	report.cycleRatio = best;
+	report.throughput = best > 0.0 ? 1.0/best : std::numeric_limits<double>::infinity();
+	reportCycle(mg, cycle, report);
+	return report;
+}
+
+ThroughputReport analyzeThroughput(const MarkedGraph &mg) {
+	vector<int> cycle;
+	return maxCycleRatio(mg, cycle);
+}
+
+ThroughputReport analyzeThroughput(const Graph &graph, const vector<int> &depths) {
+	return analyzeThroughput(MarkedGraph(graph, depths));
+}
+
+vector<int> recommendBufferDepths(const Graph &graph, double target) {
+	vector<int> depths(graph.arcs.size(), 1);
+	if (target <= 0.0) {
+		return depths;
+	}
+
+	double ratio = 1.0/target;
+	vector<int> cycle;
+	// every iteration adds at least one slot along the critical cycle
+	int maxIterations = 16*((int)graph.arcs.size() + 1);
+	for (int iteration = 0; iteration < maxIterations; iteration++) {
+		MarkedGraph mg(graph, depths);
+		ThroughputReport report = maxCycleRatio(mg, cycle);
+		if (report.deadlock or report.cycleRatio <= ratio + EPSILON) {
+			break;
+		}
+
+		int delay = 0, tokens = 0;
+		vector<int> slots;
+		for (auto edgeIdx = cycle.begin(); edgeIdx != cycle.end(); edgeIdx++) {
+			const MarkedGraph::Edge &edge = mg.edges[*edgeIdx];
+			delay += edge.delay;
+			tokens += edge.tokens;
+			if (edge.backward) {
+				slots.push_back(edge.arc);
+			}
+		}
+		if (slots.empty()) {
+			// limited by the Funcs themselves, more buffering won't help
+			break;
+		}
+
+		int needed = std::max((int)std::ceil(delay/ratio - EPSILON) - tokens, 1);
+		for (int i = 0; i < needed; i++) {
+			depths[slots[i%slots.size()]]++;
+		}
+	}
+
+	return depths;
+}
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+
+#include "graph.h"
+
+namespace flow {
+
+// Timed marked graph model of a Graph. Every node is a transition that
+// fires once per token. Every arc contributes a forward place from the
+// producer to the consumer, which holds the produced token for the
+// producer's output register, and a backward place from the consumer to the
+// producer, which holds the free slots of the channel. Each node also gets
+// a self loop since it fires at most once per cycle.
+//
+// This treats every Func as consuming a token on every connected input per
+// firing. Funcs with a Condition that acknowledges nothing are free-running
+// sources and their input arcs do not constrain them. Outputs buffered by
+// a skid buffer or FIFO add their queue to the capacity of the arc, and
+// credit channels hold as many tokens as they have credits.
+struct MarkedGraph {
+	struct Edge {
+		int from;
+		int to;
+		// cycles before the firing at from enables to
+		int delay;
+		// initial tokens in the place
+		int tokens;
+		// arc in the flow::Graph this place models, -1 for self loops
+		int arc;
+		// true for the free slots in the channel
+		bool backward;
+	};
+
+	MarkedGraph();
+	// depths gives the capacity of each arc in tokens, taken from the
+	// producer's output buffering if not specified
+	MarkedGraph(const Graph &graph, const vector<int> &depths=vector<int>());
+	~MarkedGraph();
+
+	int nodes;
+	vector<Edge> edges;
+};
+
+struct ThroughputReport {
+	ThroughputReport();
+	~ThroughputReport();
+
+	// A cycle holds no tokens, nothing on it can ever fire
+	bool deadlock;
+
+	// Maximum over all cycles of total delay over total tokens, the steady
+	// state number of cycles between two tokens
+	double cycleRatio;
+
+	// Tokens per cycle in steady state, 1/cycleRatio
+	double throughput;
+
+	// Nodes and arcs of the Graph along the critical cycle
+	vector<int> criticalNodes;
+	vector<int> criticalArcs;
+};
+
+// Maximum cycle ratio of the marked graph using Howard's policy iteration,
+// which runs in near linear time per iteration and typically converges in
+// a handful of iterations.
+ThroughputReport analyzeThroughput(const MarkedGraph &mg);
+ThroughputReport analyzeThroughput(const Graph &graph, const vector<int> &depths=vector<int>());
+
+// Smallest per-arc depths found by repeatedly deepening the arcs on the
+// critical cycle until the Graph reaches the target throughput in tokens
+// per cycle. Stops early if the critical cycle has no channel slots to add,
+// leaving the best depths found.
+vector<int> recommendBufferDepths(const Graph &graph, double target);
+
+}
@@ -0,0 +1,249 @@
+#include "timing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <sstream>
+
+#include <arithmetic/algorithm.h>
+
+#include "func.h"
+
+using arithmetic::Operation;
+
+namespace clocked {
+
+DelayModel::DelayModel(double operation, double fanout) {
+	this->operation = operation;
+	this->fanout = fanout;
+}
+
+DelayModel::~DelayModel() {
+}
+
+TimingPath::TimingPath() {
+	delay = 0.0;
+}
+
+TimingPath::~TimingPath() {
+}
+
+string TimingPath::to_string(const Module &mod) const {
+	std::ostringstream os;
+	os << delay << ":";
+	for (auto net = nets.begin(); net != nets.end(); net++) {
+		os << (net == nets.begin() ? " " : " -> ");
+		os << (*net >= 0 and *net < mod.netCount() ? mod.netAt(*net) : "?");
+	}
+	return os.str();
+}
+
+TimingReport::TimingReport() {
+}
+
+TimingReport::~TimingReport() {
+}
+
+double TimingReport::depth() const {
+	return paths.empty() ? 0.0 : paths.front().delay;
+}
+
+// Arrival time at the top of e and the net the critical path enters
+// through, -1 if it only depends on constants. load gives the arrival of
+// each net as seen by its loads, negative if it is unknown.
+pair<double, int> arrivalOf(const Expression &e, const vector<double> &load, const DelayModel &model) {
+	map<size_t, pair<double, int> > exprs;
+	auto arrivalOfOperand = [&](const Operand &operand) {
+		if (operand.isVar() and operand.index < load.size() and load[operand.index] >= 0.0) {
+			return pair<double, int>(load[operand.index], (int)operand.index);
+		} else if (operand.isExpr()) {
+			auto expr = exprs.find(operand.index);
+			if (expr != exprs.end()) {
+				return expr->second;
+			}
+		}
+		return pair<double, int>(0.0, -1);
+	};
+
+	if (not e.top.isExpr()) {
+		return arrivalOfOperand(e.top);
+	}
+
+	for (arithmetic::PostOrderDFSIterator operation_it(e.sub, {e.top}); !operation_it.done(); ++operation_it) {
+		const Operation &operation = *operation_it;
+
+		pair<double, int> worst(0.0, -1);
+		for (auto operand = operation.operands.begin(); operand != operation.operands.end(); operand++) {
+			pair<double, int> arrival = arrivalOfOperand(*operand);
+			if (arrival.second >= 0 and (worst.second < 0 or arrival.first > worst.first)) {
+				worst = arrival;
+			}
+		}
+		if (operation.func != Operation::OpType::IDENTITY) {
+			worst.first += model.operation;
+		}
+		exprs[operation.exprIndex] = worst;
+	}
+
+	return arrivalOfOperand(e.top);
+}
+
+TimingReport analyzeTiming(const Module &mod, int count, DelayModel model) {
+	TimingReport report;
+	int nets = mod.netCount();
+
+	// Every expression that reads a net is one load on it
+	vector<int> loads(nets, 0);
+	auto countLoads = [&](const Expression &e) {
+		for (size_t net : flow::getNetsInExpression(e)) {
+			if (net < loads.size()) {
+				loads[net]++;
+			}
+		}
+	};
+	for (auto assign = mod.assign.begin(); assign != mod.assign.end(); assign++) {
+		countLoads(assign->expr);
+	}
+	for (auto block = mod.blocks.begin(); block != mod.blocks.end(); block++) {
+		for (const vector<Rule> *rules : {&block->rules, &block->_else}) {
+			for (auto rule = rules->begin(); rule != rules->end(); rule++) {
+				countLoads(rule->guard);
+				for (auto assign = rule->assign.begin(); assign != rule->assign.end(); assign++) {
+					countLoads(assign->expr);
+				}
+			}
+		}
+	}
+
+	// Continuous assigns in topological order, whatever is left over sits
+	// on or behind a combinational loop
+	vector<int> driver(nets, -1);
+	vector<vector<int> > readers(nets);
+	vector<int> waiting(mod.assign.size(), 0);
+	for (int i = 0; i < (int)mod.assign.size(); i++) {
+		int net = mod.assign[i].net;
+		if (net >= 0 and net < nets) {
+			driver[net] = i;
+		}
+	}
+	for (int i = 0; i < (int)mod.assign.size(); i++) {
+		for (size_t net : flow::getNetsInExpression(mod.assign[i].expr)) {
+			if (net < (size_t)nets and driver[net] >= 0) {
+				readers[net].push_back(i);
+				waiting[i]++;
+			}
+		}
+	}
+
+	report.arrival.assign(nets, -1.0);
+	vector<double> load(nets, -1.0);
+	vector<int> pred(nets, -1);
+	auto arrive = [&](int net, double arrival) {
+		report.arrival[net] = arrival;
+		load[net] = arrival;
+		if (loads[net] > 1) {
+			load[net] += model.fanout*std::log2((double)loads[net]);
+		}
+	};
+
+	vector<int> ready;
+	for (int net = 0; net < nets; net++) {
+		if (driver[net] < 0) {
+			arrive(net, 0.0);
+		}
+	}
+	for (int i = 0; i < (int)mod.assign.size(); i++) {
+		if (waiting[i] == 0) {
+			ready.push_back(i);
+		}
+	}
+	while (not ready.empty()) {
+		int i = ready.back();
+		ready.pop_back();
+		int net = mod.assign[i].net;
+		if (net < 0 or net >= nets) {
+			continue;
+		}
+
+		pair<double, int> arrival = arrivalOf(mod.assign[i].expr, load, model);
+		arrive(net, arrival.first);
+		pred[net] = arrival.second;
+		for (auto reader = readers[net].begin(); reader != readers[net].end(); reader++) {
+			if (--waiting[*reader] == 0) {
+				ready.push_back(*reader);
+			}
+		}
+	}
+	for (int net = 0; net < nets; net++) {
+		if (report.arrival[net] < 0.0) {
+			report.loops.push_back(net);
+		}
+	}
+
+	// Endpoints are the REG nets written by rules and the OUT nets. A rule's
+	// guard gates all of its assigns, and an else branch waits on every
+	// guard in its block.
+	map<int, pair<double, int> > endpoints;
+	auto capture = [&](int net, pair<double, int> arrival) {
+		auto endpoint = endpoints.find(net);
+		if (endpoint == endpoints.end()) {
+			endpoints.insert({net, arrival});
+		} else if (arrival.second >= 0 and (endpoint->second.second < 0 or arrival.first > endpoint->second.first)) {
+			endpoint->second = arrival;
+		}
+	};
+	auto worse = [](pair<double, int> a, pair<double, int> b) {
+		return (b.second >= 0 and (a.second < 0 or b.first > a.first)) ? b : a;
+	};
+
+	for (auto block = mod.blocks.begin(); block != mod.blocks.end(); block++) {
+		pair<double, int> guards(0.0, -1);
+		for (auto rule = block->rules.begin(); rule != block->rules.end(); rule++) {
+			pair<double, int> guard = arrivalOf(rule->guard, load, model);
+			guards = worse(guards, guard);
+			for (auto assign = rule->assign.begin(); assign != rule->assign.end(); assign++) {
+				capture(assign->net, worse(guard, arrivalOf(assign->expr, load, model)));
+			}
+		}
+		for (auto rule = block->_else.begin(); rule != block->_else.end(); rule++) {
+			pair<double, int> guard = worse(guards, arrivalOf(rule->guard, load, model));
+			for (auto assign = rule->assign.begin(); assign != rule->assign.end(); assign++) {
+				capture(assign->net, worse(guard, arrivalOf(assign->expr, load, model)));
+			}
+		}
+	}
+	for (int net = 0; net < nets; net++) {
+		if (mod.nets[net].purpose == Net::Purpose::OUT and report.arrival[net] >= 0.0) {
+			capture(net, pair<double, int>(report.arrival[net], pred[net]));
+		}
+	}
+
+	for (auto endpoint = endpoints.begin(); endpoint != endpoints.end(); endpoint++) {
+		if (endpoint->first < 0 or endpoint->first >= nets) {
+			continue;
+		}
+
+		TimingPath path;
+		path.delay = endpoint->second.first;
+		path.nets.push_back(endpoint->first);
+		// walk back through the continuous assigns to the launching net
+		int curr = endpoint->second.second;
+		while (curr >= 0 and (int)path.nets.size() <= nets) {
+			path.nets.push_back(curr);
+			curr = pred[curr];
+		}
+		std::reverse(path.nets.begin(), path.nets.end());
+		report.paths.push_back(path);
+	}
+
+	std::stable_sort(report.paths.begin(), report.paths.end(), [](const TimingPath &a, const TimingPath &b) {
+		return a.delay > b.delay;
+	});
+	if (count >= 0 and (int)report.paths.size() > count) {
+		report.paths.resize(count);
+	}
+
+	return report;
+}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "module.h"
+
+namespace clocked {
+
+// Delay of combinational logic in abstract units. Every operator costs
+// operation and identities are free. A net driving more than one load adds
+// fanout for every doubling of its loads, as a buffer tree would.
+struct DelayModel {
+	DelayModel(double operation=1.0, double fanout=0.0);
+	~DelayModel();
+
+	double operation;
+	double fanout;
+};
+
+struct TimingPath {
+	TimingPath();
+	~TimingPath();
+
+	// From the IN or REG net that launches the path, through the wires
+	// driven by continuous assigns, to the REG or OUT net that captures it
+	vector<int> nets;
+	double delay;
+
+	string to_string(const Module &mod) const;
+};
+
+struct TimingReport {
+	TimingReport();
+	~TimingReport();
+
+	// Arrival time of every net, -1 for nets on or behind a combinational
+	// loop
+	vector<double> arrival;
+
+	// Worst path into each endpoint, most critical first
+	vector<TimingPath> paths;
+
+	// Nets on or behind a combinational loop
+	vector<int> loops;
+
+	// Delay of the most critical path, the logic depth of the Module
+	double depth() const;
+};
+
+// Static timing over the combinational logic of mod. Continuous assigns
+// drive wires from IN and REG nets, and the guards and assigns of every
+// rule feed the REG nets of its block. Reports the count worst endpoints.
+// Paths end at the ports of mod, so paths that cross between the Funcs of
+// a Graph only show up once it is flattened with flattenGraph().
+TimingReport analyzeTiming(const Module &mod, int count=10, DelayModel model=DelayModel());
+
+}
@@ -0,0 +1,77 @@
+#include "trace.h"
+
+namespace flow {
+
+TraceSink::TraceSink() {
+}
+
+TraceSink::~TraceSink() {
+}
+
+void TraceSink::condition(int cond, const Expression &guard) {
+}
+
+void TraceSink::net(int funcNet, int data, int valid, int ready) {
+}
+
+void TraceSink::probe(int channel, int valid, int data) {
+}
+
+void TraceSink::minimized(const Expression &before, const Expression &after) {
+}
+
+PrintTrace::PrintTrace(std::ostream &os) {
+	this->os = &os;
+}
+
+PrintTrace::~PrintTrace() {
+}
+
+void PrintTrace::condition(int cond, const Expression &guard) {
+	*os << "condition " << cond << ": " << guard.to_string() << std::endl;
+}
+
+void PrintTrace::net(int funcNet, int data, int valid, int ready) {
+	*os << "net " << funcNet << " -> data " << data << " valid " << valid << " ready " << ready << std::endl;
+}
+
+void PrintTrace::probe(int channel, int valid, int data) {
+	*os << "probe " << channel << " -> valid " << valid << " data " << data << std::endl;
+}
+
+void PrintTrace::minimized(const Expression &before, const Expression &after) {
+	*os << "minimized " << before.to_string() << " -> " << after.to_string() << std::endl;
+}
+
+Tracer::Tracer(TraceSink *sink) {
+	this->sink = sink;
+}
+
+Tracer::~Tracer() {
+}
+
+void Tracer::condition(int cond, const Expression &guard) {
+	if (sink != nullptr) {
+		sink->condition(cond, guard);
+	}
+}
+
+void Tracer::net(int funcNet, int data, int valid, int ready) {
+	if (sink != nullptr) {
+		sink->net(funcNet, data, valid, ready);
+	}
+}
+
+void Tracer::probe(int channel, int valid, int data) {
+	if (sink != nullptr) {
+		sink->probe(channel, valid, data);
+	}
+}
+
+void Tracer::minimized(const Expression &before, const Expression &after) {
+	if (sink != nullptr) {
+		sink->minimized(before, after);
+	}
+}
+
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <iostream>
+
+#include <arithmetic/expression.h>
+
+using arithmetic::Expression;
+
+namespace flow {
+
+// Synthesis reports what it is doing through a tracer passed in as a
+// template parameter. NoTrace compiles every event away, and Tracer hands
+// them to a TraceSink picked at run time, like PrintTrace or a profiler.
+// Events that need extra work to produce are skipped unless the tracer's
+// enabled flag is set.
+
+// Receives the events of a Tracer, each one ignored by default
+struct TraceSink {
+	TraceSink();
+	virtual ~TraceSink();
+
+	// Condition cond became a branch, which fires on guard
+	virtual void condition(int cond, const Expression &guard);
+
+	// Func net funcNet is carried by these Module nets, -1 for missing ones
+	virtual void net(int funcNet, int data, int valid, int ready);
+
+	// A probe() of the channel on Func net channel was lowered onto these
+	// valid and data nets
+	virtual void probe(int channel, int valid, int data);
+
+	// An expression was simplified on its way into the Module
+	virtual void minimized(const Expression &before, const Expression &after);
+};
+
+// Writes every event on its own line
+struct PrintTrace : TraceSink {
+	PrintTrace(std::ostream &os=std::cout);
+	~PrintTrace();
+
+	std::ostream *os;
+
+	void condition(int cond, const Expression &guard);
+	void net(int funcNet, int data, int valid, int ready);
+	void probe(int channel, int valid, int data);
+	void minimized(const Expression &before, const Expression &after);
+};
+
+// The events are empty inline functions so that they vanish entirely
+struct NoTrace {
+	static constexpr bool enabled = false;
+
+	void condition(int cond, const Expression &guard) {}
+	void net(int funcNet, int data, int valid, int ready) {}
+	void probe(int channel, int valid, int data) {}
+	void minimized(const Expression &before, const Expression &after) {}
+};
+
+// Forwards every event to sink, if there is one
+struct Tracer {
+	Tracer(TraceSink *sink=nullptr);
+	~Tracer();
+
+	static constexpr bool enabled = true;
+	TraceSink *sink;
+
+	void condition(int cond, const Expression &guard);
+	void net(int funcNet, int data, int valid, int ready);
+	void probe(int channel, int valid, int data);
+	void minimized(const Expression &before, const Expression &after);
+};
+
+// Minimizes e, reporting the change when tracing
+template <typename Trace>
+void minimize(Expression &e, Trace &trace) {
+	if constexpr (Trace::enabled) {
+		Expression before = e;
+		e.minimize();
+		trace.minimized(before, e);
+	} else {
+		e.minimize();
+	}
+}
+
+}
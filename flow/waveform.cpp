@@ -0,0 +1,311 @@
+#include "waveform.h"
+
+#include <algorithm>
+#include <bit>
+
+namespace clocked {
+
+static const char MAGIC[8] = {'F', 'L', 'O', 'W', 'W', 'A', 'V', 'E'};
+static const uint64_t VERSION = 1;
+
+void putVarint(vector<uint8_t> &buffer, uint64_t value) {
+	while (value >= 0x80) {
+		buffer.push_back((uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	buffer.push_back((uint8_t)value);
+}
+
+void putString(vector<uint8_t> &buffer, const string &value) {
+	putVarint(buffer, value.size());
+	buffer.insert(buffer.end(), value.begin(), value.end());
+}
+
+bool getVarint(const uint8_t *&ptr, const uint8_t *end, uint64_t &value) {
+	value = 0;
+	for (int shift = 0; ptr < end and shift < 64; shift += 7) {
+		uint8_t byte = *ptr++;
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool getVarint(std::istream &in, uint64_t &value) {
+	value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int byte = in.get();
+		if (byte == EOF) {
+			return false;
+		}
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool getString(std::istream &in, string &value) {
+	uint64_t size = 0;
+	if (not getVarint(in, size) or size > (1u << 20)) {
+		return false;
+	}
+	value.resize(size);
+	return (bool)in.read(value.data(), size);
+}
+
+bool endsWith(const string &str, const string &suffix) {
+	return str.size() >= suffix.size() and str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+int signalOf(const Net &net) {
+	if (endsWith(net.name, "_valid")) {
+		return WaveformWriter::VALID;
+	} else if (endsWith(net.name, "_ready")) {
+		return WaveformWriter::READY;
+	} else if (endsWith(net.name, "_data")) {
+		return WaveformWriter::DATA;
+	}
+	return WaveformWriter::OTHER;
+}
+
+WaveformWriter::WaveformWriter() {
+	sim = nullptr;
+	lane = 0;
+	blockSize = 1<<20;
+	lastTime = 0;
+	pending = false;
+	done = false;
+}
+
+WaveformWriter::~WaveformWriter() {
+	close();
+}
+
+bool WaveformWriter::open(const BatchSimulator &sim, string path, int lane, int signals, size_t blockSize) {
+	close();
+	if (sim.mod == nullptr) {
+		return false;
+	}
+	file.open(path, std::ios::binary | std::ios::trunc);
+	if (not file) {
+		return false;
+	}
+
+	this->sim = &sim;
+	this->lane = lane;
+	this->blockSize = std::max(blockSize, (size_t)64);
+	nets.clear();
+	for (int net = 0; net < (int)sim.mod->nets.size(); net++) {
+		if (signalOf(sim.mod->nets[net]) & signals) {
+			nets.push_back(net);
+		}
+	}
+	last.assign(nets.size(), 0);
+	lastTime = 0;
+
+	front.assign(MAGIC, MAGIC + sizeof(MAGIC));
+	putVarint(front, VERSION);
+	putString(front, sim.mod->name);
+	putVarint(front, nets.size());
+	for (auto net = nets.begin(); net != nets.end(); net++) {
+		putVarint(front, *net);
+		putVarint(front, std::max(sim.mod->nets[*net].type.width, 1));
+		putString(front, sim.mod->nets[*net].name);
+	}
+	file.write((const char*)front.data(), front.size());
+	front.clear();
+	front.reserve(this->blockSize + 64);
+	back.reserve(this->blockSize + 64);
+
+	pending = false;
+	done = false;
+	writer = std::thread([this]() {
+		vector<uint8_t> size;
+		std::unique_lock<std::mutex> guard(lock);
+		while (true) {
+			ready.wait(guard, [this]() { return pending or done; });
+			if (not pending) {
+				break;
+			}
+
+			// back belongs to this thread until pending is cleared
+			guard.unlock();
+			size.clear();
+			putVarint(size, back.size());
+			file.write((const char*)size.data(), size.size());
+			file.write((const char*)back.data(), back.size());
+			back.clear();
+			guard.lock();
+
+			pending = false;
+			ready.notify_all();
+		}
+	});
+	return true;
+}
+
+bool WaveformWriter::isOpen() const {
+	return writer.joinable();
+}
+
+void WaveformWriter::sample(uint64_t time) {
+	if (sim == nullptr) {
+		return;
+	}
+
+	// Samples with no changes are left out, the next one's time covers them
+	int prev = -1;
+	for (int i = 0; i < (int)nets.size(); i++) {
+		uint64_t value = sim->get(nets[i], lane);
+		if (value != last[i]) {
+			if (prev < 0) {
+				putVarint(front, time - lastTime);
+				lastTime = time;
+			}
+			putVarint(front, i - prev);
+			putVarint(front, value ^ last[i]);
+			last[i] = value;
+			prev = i;
+		}
+	}
+	if (prev >= 0) {
+		putVarint(front, 0);
+	}
+
+	if (front.size() >= blockSize) {
+		flush();
+	}
+}
+
+void WaveformWriter::flush() {
+	if (front.empty() or not writer.joinable()) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+	ready.wait(guard, [this]() { return not pending; });
+	std::swap(front, back);
+	pending = true;
+	guard.unlock();
+	ready.notify_all();
+}
+
+void WaveformWriter::close() {
+	if (writer.joinable()) {
+		flush();
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			done = true;
+		}
+		ready.notify_all();
+		writer.join();
+	}
+	if (file.is_open()) {
+		file.close();
+	}
+	sim = nullptr;
+}
+
+// Short printable identifier of the i-th variable
+string vcdCode(size_t i) {
+	string code;
+	do {
+		code.push_back((char)('!' + i%94));
+		i /= 94;
+	} while (i > 0);
+	return code;
+}
+
+void vcdValue(string &out, uint64_t value, int width, const string &code) {
+	if (width == 1) {
+		out.push_back(value ? '1' : '0');
+	} else {
+		out.push_back('b');
+		int top = std::max((int)std::bit_width(value), 1);
+		for (int bit = top-1; bit >= 0; bit--) {
+			out.push_back(((value >> bit) & 1) ? '1' : '0');
+		}
+		out.push_back(' ');
+	}
+	out += code;
+	out.push_back('\n');
+}
+
+bool exportVcd(std::istream &in, std::ostream &out, string timescale) {
+	char magic[sizeof(MAGIC)];
+	uint64_t version = 0, count = 0;
+	string name;
+	if (not in.read(magic, sizeof(magic)) or not std::equal(magic, magic + sizeof(magic), MAGIC)
+		or not getVarint(in, version) or version != VERSION
+		or not getString(in, name) or not getVarint(in, count)) {
+		return false;
+	}
+
+	vector<int> widths;
+	vector<string> codes;
+	string text = "$timescale " + timescale + " $end\n$scope module " + name + " $end\n";
+	for (uint64_t i = 0; i < count; i++) {
+		uint64_t net = 0, width = 0;
+		string netName;
+		if (not getVarint(in, net) or not getVarint(in, width) or not getString(in, netName)) {
+			return false;
+		}
+		widths.push_back((int)width);
+		codes.push_back(vcdCode(i));
+		text += "$var wire " + ::to_string(width) + " " + codes.back() + " " + netName + " $end\n";
+	}
+	text += "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n";
+	for (uint64_t i = 0; i < count; i++) {
+		vcdValue(text, 0, widths[i], codes[i]);
+	}
+	text += "$end\n";
+
+	vector<uint64_t> values(count, 0);
+	uint64_t time = 0, shown = 0;
+	vector<uint8_t> block;
+	uint64_t size = 0;
+	while (getVarint(in, size)) {
+		block.resize(size);
+		if (not in.read((char*)block.data(), size)) {
+			return false;
+		}
+
+		const uint8_t *ptr = block.data(), *end = block.data() + block.size();
+		uint64_t delta = 0;
+		while (ptr < end and getVarint(ptr, end, delta)) {
+			time += delta;
+			if (time != shown) {
+				text += "#" + ::to_string(time) + "\n";
+				shown = time;
+			}
+			uint64_t i = (uint64_t)-1, gap = 0, change = 0;
+			while (getVarint(ptr, end, gap) and gap != 0) {
+				i += gap;
+				if (i >= count or not getVarint(ptr, end, change)) {
+					return false;
+				}
+				values[i] ^= change;
+				vcdValue(text, values[i], widths[i], codes[i]);
+			}
+		}
+
+		if (text.size() >= (1u << 20)) {
+			out.write(text.data(), text.size());
+			text.clear();
+		}
+	}
+	out.write(text.data(), text.size());
+	return (bool)out;
+}
+
+bool exportVcd(string wavePath, string vcdPath, string timescale) {
+	std::ifstream in(wavePath, std::ios::binary);
+	std::ofstream out(vcdPath, std::ios::binary | std::ios::trunc);
+	return in and out and exportVcd(in, out, timescale);
+}
+
+}
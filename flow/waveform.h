@@ -0,0 +1,83 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "simulate.h"
+
+namespace clocked {
+
+// Records the nets of one lane of a BatchSimulator as the simulation runs.
+//
+// The file starts with "FLOWWAVE", a version, the name of the Module and
+// the index, width and name of every recorded net. After that come blocks,
+// each a byte count and then samples. A sample is the time since the last
+// one, then for each net that changed the gap in the list of recorded nets
+// since the last change and its new value XOR its old one, then a zero.
+// Every number is a LEB128 varint. Samples where nothing changed are left
+// out, and one where a single valid bit toggles takes four bytes.
+//
+// Blocks are written by a background thread while the next one fills, so
+// sample() only ever waits on the disk if it falls a whole block behind.
+struct WaveformWriter {
+	// Which nets to record, by the suffix of their name
+	enum Signals {
+		VALID = 1,
+		READY = 2,
+		DATA = 4,
+		OTHER = 8,
+		CHANNELS = VALID | READY | DATA,
+		ALL = CHANNELS | OTHER,
+	};
+
+	WaveformWriter();
+	~WaveformWriter();
+
+	const BatchSimulator *sim;
+	int lane;
+	size_t blockSize;
+
+	// The recorded nets and their value at the last sample
+	vector<int> nets;
+	vector<uint64_t> last;
+	uint64_t lastTime;
+
+	// Samples fill front while the writer thread drains back
+	vector<uint8_t> front;
+	vector<uint8_t> back;
+	bool pending;
+	bool done;
+	std::mutex lock;
+	std::condition_variable ready;
+	std::thread writer;
+	std::ofstream file;
+
+	// Start recording the nets picked by signals in the given lane of sim.
+	// Returns false if the file can't be opened.
+	bool open(const BatchSimulator &sim, string path, int lane=0, int signals=ALL, size_t blockSize=1<<20);
+	bool isOpen() const;
+
+	// Record the nets that changed since the last sample, call it once the
+	// simulator has settled. time must not go backwards.
+	void sample(uint64_t time);
+
+	// Write out what is left and close the file
+	void close();
+
+	// Hand front to the writer thread
+	void flush();
+};
+
+// The Signals a net falls under
+int signalOf(const Net &net);
+
+// Convert a waveform to VCD text, returns false if it isn't a waveform
+bool exportVcd(std::istream &in, std::ostream &out, string timescale="1ns");
+bool exportVcd(string wavePath, string vcdPath, string timescale="1ns");
+
+}
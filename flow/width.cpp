@@ -0,0 +1,413 @@
+#include "width.h"
+
+#include <algorithm>
+#include <bit>
+#include <map>
+
+#include <arithmetic/algorithm.h>
+
+using arithmetic::Operand;
+using arithmetic::Operation;
+
+namespace flow {
+
+// Bounds stop being tracked past this many bits so that sums of bounded
+// ranges never overflow int64_t
+static const int MAX_BOUNDED_WIDTH = 40;
+
+// Shift amounts past this are taken to be this, so widths stay in an int
+static const int64_t MAX_SHIFT = 4096;
+
+Range::Range() {
+	this->bounded = true;
+	this->lo = 0;
+	this->hi = 0;
+	this->width = 1;
+}
+
+Range::Range(int64_t lo, int64_t hi) {
+	this->lo = lo;
+	this->hi = hi;
+	this->width = bitWidth(hi);
+	this->bounded = (width <= MAX_BOUNDED_WIDTH);
+}
+
+Range::~Range() {
+}
+
+bool Range::isKnown() const {
+	return width >= 0;
+}
+
+Range Range::hull(const Range &r) const {
+	if (not isKnown() or not r.isKnown()) {
+		return unknown();
+	}
+	if (bounded and r.bounded) {
+		return Range(std::min(lo, r.lo), std::max(hi, r.hi));
+	}
+	return ofWidth(std::max(width, r.width));
+}
+
+Range Range::clamp(int width) const {
+	if (not isKnown() or this->width > width) {
+		return ofWidth(width);
+	}
+	return *this;
+}
+
+Range Range::unknown() {
+	Range result;
+	result.bounded = false;
+	result.width = -1;
+	return result;
+}
+
+Range Range::ofWidth(int width) {
+	if (width < 0) {
+		return unknown();
+	} else if (width <= MAX_BOUNDED_WIDTH) {
+		return Range(0, (((int64_t)1) << width) - 1);
+	}
+
+	Range result;
+	result.bounded = false;
+	result.width = width;
+	return result;
+}
+
+Range Range::ofType(const Type &type) {
+	return ofWidth(type.width);
+}
+
+std::ostream& operator<<(std::ostream& os, const Range& r) {
+	if (not r.isKnown()) {
+		return os << "Range(unknown)";
+	} else if (not r.bounded) {
+		return os << "Range(width:" << r.width << ")";
+	}
+	return os << "Range([" << r.lo << ", " << r.hi << "], width:" << r.width << ")";
+}
+
+int bitWidth(int64_t value) {
+	if (value <= 0) {
+		return 1;
+	}
+	return (int)std::bit_width((uint64_t)value);
+}
+
+Range rangeOfConst(const arithmetic::Value &value) {
+	if (value.type == arithmetic::Value::BOOL) {
+		return Range(0, 1);
+	} else if (value.type == arithmetic::Value::INT and value.ival >= 0) {
+		return Range(value.ival, value.ival);
+	} else if (value.type == arithmetic::Value::REAL and value.rval >= 0.0
+		and value.rval == (double)(int64_t)value.rval) {
+		return Range((int64_t)value.rval, (int64_t)value.rval);
+	}
+	return Range::unknown();
+}
+
+// Range of the result of op given the ranges of its operands, assuming
+// unsigned operands as the rest of synthesis does
+Range rangeOfOperation(int func, const vector<Range> &args) {
+	for (auto arg = args.begin(); arg != args.end(); arg++) {
+		if (not arg->isKnown()) {
+			switch (func) {
+				case Operation::OpType::BOOLEAN_NOT:
+				case Operation::OpType::BOOLEAN_AND:
+				case Operation::OpType::BOOLEAN_OR:
+				case Operation::OpType::BOOLEAN_XOR:
+				case Operation::OpType::EQUAL:
+				case Operation::OpType::NOT_EQUAL:
+				case Operation::OpType::LESS:
+				case Operation::OpType::GREATER:
+				case Operation::OpType::LESS_EQUAL:
+				case Operation::OpType::GREATER_EQUAL:
+				case Operation::OpType::VALIDITY:
+					return Range(0, 1);
+				default:
+					return Range::unknown();
+			}
+		}
+	}
+	if (args.empty()) {
+		return Range::unknown();
+	}
+
+	bool bounded = true;
+	int maxWidth = 0;
+	int minWidth = args[0].width;
+	for (auto arg = args.begin(); arg != args.end(); arg++) {
+		bounded = bounded and arg->bounded;
+		maxWidth = std::max(maxWidth, arg->width);
+		minWidth = std::min(minWidth, arg->width);
+	}
+
+	switch (func) {
+		case Operation::OpType::IDENTITY:
+			return args[0];
+
+		case Operation::OpType::BOOLEAN_NOT:
+		case Operation::OpType::BOOLEAN_AND:
+		case Operation::OpType::BOOLEAN_OR:
+		case Operation::OpType::BOOLEAN_XOR:
+		case Operation::OpType::EQUAL:
+		case Operation::OpType::NOT_EQUAL:
+		case Operation::OpType::LESS:
+		case Operation::OpType::GREATER:
+		case Operation::OpType::LESS_EQUAL:
+		case Operation::OpType::GREATER_EQUAL:
+		case Operation::OpType::VALIDITY:
+			return Range(0, 1);
+
+		case Operation::OpType::BITWISE_NOT:
+		case Operation::OpType::NEGATION:
+		case Operation::OpType::NEGATIVE:
+			return Range::ofWidth(maxWidth);
+
+		case Operation::OpType::BITWISE_AND:
+			if (bounded) {
+				int64_t hi = args[0].hi;
+				for (auto arg = args.begin(); arg != args.end(); arg++) {
+					hi = std::min(hi, arg->hi);
+				}
+				return Range(0, hi);
+			}
+			return Range::ofWidth(minWidth);
+
+		case Operation::OpType::BITWISE_OR:
+		case Operation::OpType::BITWISE_XOR:
+			return Range::ofWidth(maxWidth);
+
+		case Operation::OpType::ADD:
+			if (bounded) {
+				int64_t lo = 0, hi = 0;
+				for (auto arg = args.begin(); arg != args.end(); arg++) {
+					lo += arg->lo;
+					hi += arg->hi;
+				}
+				return Range(lo, hi);
+			}
+			return Range::ofWidth(maxWidth + bitWidth((int64_t)args.size()-1));
+
+		case Operation::OpType::SUBTRACT:
+			if (bounded and args.size() == 2 and args[0].lo >= args[1].hi) {
+				return Range(args[0].lo - args[1].hi, args[0].hi - args[1].lo);
+			}
+			// may wrap below zero
+			return Range::ofWidth(maxWidth + (int)args.size() - 1);
+
+		case Operation::OpType::MULTIPLY: {
+			int width = 0;
+			for (auto arg = args.begin(); arg != args.end(); arg++) {
+				width += arg->width;
+			}
+			if (bounded and width < 63) {
+				int64_t lo = 1, hi = 1;
+				for (auto arg = args.begin(); arg != args.end(); arg++) {
+					lo *= arg->lo;
+					hi *= arg->hi;
+				}
+				return Range(lo, hi);
+			}
+			return Range::ofWidth(width);
+		}
+
+		case Operation::OpType::DIVIDE:
+			if (args.size() != 2) {
+				return Range::ofWidth(args[0].width);
+			} else if (bounded) {
+				return Range(args[1].hi > 0 ? args[0].lo / args[1].hi : 0, args[0].hi / std::max(args[1].lo, (int64_t)1));
+			} else if (args[1].bounded and args[1].lo > 0) {
+				return Range::ofWidth(std::max(args[0].width - bitWidth(args[1].lo) + 1, 1));
+			}
+			return Range::ofWidth(args[0].width);
+
+		case Operation::OpType::MOD:
+			if (args.size() != 2) {
+				return Range::ofWidth(args[0].width);
+			} else if (args[1].bounded and args[1].hi > 0) {
+				if (args[0].bounded and args[0].hi < args[1].lo) {
+					return args[0];
+				}
+				int64_t hi = args[1].hi - 1;
+				if (args[0].bounded) {
+					hi = std::min(hi, args[0].hi);
+				}
+				return Range(0, hi);
+			}
+			return Range::ofWidth(args[0].width);
+
+		case Operation::OpType::LEFT_SHIFT:
+			if (args.size() != 2 or not args[1].bounded) {
+				return Range::unknown();
+			} else if (args[0].bounded and args[0].width + args[1].hi < 63) {
+				return Range(args[0].lo << args[1].lo, args[0].hi << args[1].hi);
+			}
+			return Range::ofWidth(args[0].width + (int)std::min(args[1].hi, MAX_SHIFT));
+
+		case Operation::OpType::RIGHT_SHIFT:
+			if (args.size() != 2 or not args[1].bounded) {
+				return Range::ofWidth(args[0].width);
+			} else if (args[0].bounded) {
+				return Range(args[1].hi < 63 ? args[0].lo >> args[1].hi : 0, args[0].hi >> std::min(args[1].lo, (int64_t)62));
+			}
+			return Range::ofWidth(std::max(args[0].width - (int)std::min(args[1].lo, MAX_SHIFT), 1));
+
+		default:
+			return Range::unknown();
+	}
+}
+
+Range inferRange(const Expression &e, const vector<Range> &nets) {
+	map<size_t, Range> exprs;
+	auto rangeOfOperand = [&](const Operand &operand) {
+		if (operand.isConst()) {
+			return rangeOfConst(operand.cnst);
+		} else if (operand.isVar()) {
+			return operand.index < nets.size() ? nets[operand.index] : Range::unknown();
+		} else if (operand.isExpr()) {
+			auto expr = exprs.find(operand.index);
+			return expr != exprs.end() ? expr->second : Range::unknown();
+		}
+		return Range::unknown();
+	};
+
+	if (not e.top.isExpr()) {
+		return rangeOfOperand(e.top);
+	}
+
+	for (arithmetic::PostOrderDFSIterator operation_it(e.sub, {e.top}); !operation_it.done(); ++operation_it) {
+		const Operation &operation = *operation_it;
+
+		// probe(x) is either the validity or the data of x, cover both
+		if (operation.func == Operation::OpType::CALL) {
+			if (operation.operands.size() == 2 and operation.operands[0].cnst.sval == "probe") {
+				exprs[operation.exprIndex] = rangeOfOperand(operation.operands[1]).hull(Range(0, 1));
+			} else {
+				exprs[operation.exprIndex] = Range::unknown();
+			}
+			continue;
+		}
+
+		vector<Range> args;
+		for (auto operand = operation.operands.begin(); operand != operation.operands.end(); operand++) {
+			args.push_back(rangeOfOperand(*operand));
+		}
+		exprs[operation.exprIndex] = rangeOfOperation(operation.func, args);
+	}
+
+	return rangeOfOperand(e.top);
+}
+
+// Fixpoint over the values written to REG and OUT nets. required tracks
+// the widest value written before truncation to the declared width.
+vector<Range> inferRanges(const Func &func, const vector<Range> &inputs, vector<int> &required) {
+	static const int MAX_ITERATIONS = 8;
+
+	vector<Range> nets;
+	required.assign(func.nets.size(), 1);
+	for (auto net = func.nets.begin(); net != func.nets.end(); net++) {
+		size_t netIdx = net - func.nets.begin();
+		if (net->purpose == Net::Purpose::IN and netIdx < inputs.size() and inputs[netIdx].isKnown()) {
+			nets.push_back(inputs[netIdx].clamp(net->type.width));
+		} else if (net->purpose == Net::Purpose::IN or net->purpose == Net::Purpose::NONE) {
+			nets.push_back(Range::ofType(net->type));
+		} else {
+			// reset value
+			nets.push_back(Range(0, 0));
+		}
+	}
+
+	bool changed = true;
+	for (int iteration = 0; changed; iteration++) {
+		changed = false;
+		vector<Range> next = nets;
+		auto write = [&](int net, const Expression &expr) {
+			Range value = inferRange(expr, nets);
+			int declared = func.nets[net].type.width;
+			if (not value.isKnown()) {
+				// nothing to narrow to, keep the declared type
+				value = Range::ofWidth(declared);
+			}
+			required[net] = std::max(required[net], value.width);
+			if (iteration >= MAX_ITERATIONS) {
+				// feedback did not settle, widen to the declared type
+				value = Range::ofWidth(declared);
+				required[net] = std::max(required[net], declared);
+			}
+
+			Range stored = next[net].hull(value.clamp(declared));
+			if (stored.width != next[net].width or stored.lo != next[net].lo or stored.hi != next[net].hi) {
+				next[net] = stored;
+				changed = true;
+			}
+		};
+
+		for (auto cond = func.conds.begin(); cond != func.conds.end(); cond++) {
+			for (auto reg = cond->regs.begin(); reg != cond->regs.end(); reg++) {
+				write(reg->first, reg->second);
+			}
+			for (auto out = cond->outs.begin(); out != cond->outs.end(); out++) {
+				write(out->first, out->second);
+			}
+		}
+		nets = next;
+	}
+
+	return nets;
+}
+
+vector<Range> inferRanges(const Func &func) {
+	vector<int> required;
+	return inferRanges(func, vector<Range>(), required);
+}
+
+vector<Range> inferRanges(const Func &func, const vector<Range> &inputs) {
+	vector<int> required;
+	return inferRanges(func, inputs, required);
+}
+
+WidthReport::WidthReport() {
+	this->net = -1;
+	this->declared = 0;
+	this->required = 0;
+}
+
+WidthReport::WidthReport(int net, int declared, int required) {
+	this->net = net;
+	this->declared = declared;
+	this->required = required;
+}
+
+WidthReport::~WidthReport() {
+}
+
+std::ostream& operator<<(std::ostream& os, const WidthReport& r) {
+	return os << "WidthReport(net:" << r.net
+	          << ", declared:" << r.declared
+	          << ", required:" << r.required << ")";
+}
+
+vector<WidthReport> narrowWidths(Func &func) {
+	vector<int> required;
+	inferRanges(func, vector<Range>(), required);
+
+	vector<WidthReport> reports;
+	for (size_t netIdx = 0; netIdx < func.nets.size(); netIdx++) {
+		Net &net = func.nets[netIdx];
+		if (net.purpose != Net::Purpose::REG and net.purpose != Net::Purpose::OUT) {
+			continue;
+		}
+
+		if (required[netIdx] > net.type.width) {
+			reports.push_back(WidthReport((int)netIdx, net.type.width, required[netIdx]));
+		} else if (net.purpose == Net::Purpose::REG) {
+			net.type.width = std::min(required[netIdx], net.type.width);
+		}
+	}
+	return reports;
+}
+
+}
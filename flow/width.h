@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <arithmetic/expression.h>
+
+#include "func.h"
+
+using arithmetic::Expression;
+
+namespace flow {
+
+// Conservative range of the unsigned values an expression can take. The
+// bounds are only tracked while they fit comfortably in 64 bits, past that
+// only the bit width is known. A width of -1 means nothing is known.
+struct Range {
+	Range();
+	Range(int64_t lo, int64_t hi);
+	~Range();
+
+	bool bounded;
+	int64_t lo;
+	int64_t hi;
+	int width;
+
+	bool isKnown() const;
+	Range hull(const Range &r) const;
+	Range clamp(int width) const;
+
+	static Range unknown();
+	static Range ofWidth(int width);
+	static Range ofType(const Type &type);
+
+	friend std::ostream& operator<<(std::ostream& os, const Range& r);
+};
+
+// Number of bits needed to hold value, at least one
+int bitWidth(int64_t value);
+
+// Range of a constant, unknown if it is negative or fractional
+Range rangeOfConst(const arithmetic::Value &value);
+
+// Range of the result of an operation of type func given the ranges of
+// its operands
+Range rangeOfOperation(int func, const vector<Range> &args);
+
+// Range of e given the range of each net it references, indexed by net
+Range inferRange(const Expression &e, const vector<Range> &nets);
+
+// Range of every net in func. IN nets take their declared range, REG and OUT
+// nets the hull of everything written to them starting from the reset value
+// of 0. Register feedback is iterated to a fixpoint and widened to the
+// declared width if it does not settle.
+vector<Range> inferRanges(const Func &func);
+
+// Same, with the range of each IN net narrowed to inputs, indexed by net.
+// Unknown entries keep the declared range.
+vector<Range> inferRanges(const Func &func, const vector<Range> &inputs);
+
+struct WidthReport {
+	WidthReport();
+	WidthReport(int net, int declared, int required);
+	~WidthReport();
+
+	int net;
+	int declared;
+	int required;
+
+	friend std::ostream& operator<<(std::ostream& os, const WidthReport& r);
+};
+
+// Narrow every REG to the width its writes actually need. Returns a report
+// for each REG and OUT net whose declared width is smaller than the widest
+// value written to it, left unnarrowed. A write that wraps on purpose says
+// so with a % or mask that brings it into range, as in (count + 1) % 4,
+// so a plain count + 1 that overflows its net is reported.
+vector<WidthReport> narrowWidths(Func &func);
+
+}
@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+
+#include <flow/fixed.h>
+
+using namespace flow;
+
+typedef unsigned __int128 u128;
+
+// The low bits of a Fixed as a 128 bit integer
+template <int Width, int Shift>
+u128 lowBits(const Fixed<Width, Shift> &value) {
+	u128 result = value.limb[0];
+	if (Fixed<Width, Shift>::limbs > 1) {
+		result |= (u128)value.limb[1] << 64;
+	}
+	return result;
+}
+
+template <int Width>
+Fixed<Width> ofU128(u128 value) {
+	uint64_t words[Fixed<Width>::limbs] = {};
+	words[0] = (uint64_t)value;
+	if (Fixed<Width>::limbs > 1) {
+		words[1] = (uint64_t)(value >> 64);
+	}
+	return Fixed<Width>::ofBits(words);
+}
+
+// Every operation against 128 bit arithmetic masked to Width bits
+template <int Width>
+void checkAgainstU128(uint64_t seed) {
+	u128 mask = Width >= 128 ? ~(u128)0 : ((u128)1 << Width) - 1;
+	uint64_t state = seed;
+	auto next = [&]() {
+		state = state*6364136223846793005ull + 1442695040888963407ull;
+		return ((u128)state << 64) | (state*0x9E3779B97F4A7C15ull);
+	};
+
+	for (int i = 0; i < 1000; i++) {
+		u128 a = next() & mask;
+		u128 b = next() & mask;
+		if (i%10 == 0) {
+			b = a;
+		} else if (i%10 == 1) {
+			b >>= 64 + i%32;
+		}
+		int n = (int)(next()%(Width+8));
+		Fixed<Width> x = ofU128<Width>(a);
+		Fixed<Width> y = ofU128<Width>(b);
+
+		EXPECT_TRUE(lowBits(x + y) == ((a + b) & mask));
+		EXPECT_TRUE(lowBits(x - y) == ((a - b) & mask));
+		EXPECT_TRUE(lowBits(x * y) == ((a * b) & mask));
+		EXPECT_TRUE(lowBits(x & y) == (a & b));
+		EXPECT_TRUE(lowBits(x | y) == (a | b));
+		EXPECT_TRUE(lowBits(x ^ y) == (a ^ b));
+		EXPECT_TRUE(lowBits(~x) == (~a & mask));
+		EXPECT_TRUE(lowBits(-x) == ((0 - a) & mask));
+		EXPECT_TRUE(lowBits(x << n) == (n >= 128 ? 0 : (a << n) & mask));
+		EXPECT_TRUE(lowBits(x >> n) == (n >= 128 ? 0 : a >> n));
+		if (b != 0) {
+			EXPECT_TRUE(lowBits(x / y) == a / b);
+			EXPECT_TRUE(lowBits(x % y) == a % b);
+		}
+		EXPECT_EQ(x == y, a == b);
+		EXPECT_EQ(x < y, a < b);
+		EXPECT_EQ(x > y, a > b);
+	}
+}
+
+TEST(FixedPoint, SingleWord) {
+	checkAgainstU128<1>(1);
+	checkAgainstU128<13>(2);
+	checkAgainstU128<64>(3);
+
+	Fixed<8> x(250);
+	EXPECT_EQ((x + Fixed<8>(10)).low(), 4u);
+	EXPECT_EQ((Fixed<8>(3) - Fixed<8>(5)).low(), 254u);
+	EXPECT_EQ(Fixed<8>(0x1FF).low(), 0xFFu);
+	EXPECT_EQ(sizeof(Fixed<64>), 8u);
+}
+
+TEST(FixedPoint, MultiLimb) {
+	checkAgainstU128<65>(4);
+	checkAgainstU128<100>(5);
+	checkAgainstU128<128>(6);
+
+	// carries ripple across every limb
+	Fixed<300> ones = ~Fixed<300>();
+	EXPECT_TRUE((ones + Fixed<300>(1)).isZero());
+	EXPECT_TRUE(Fixed<300>() - Fixed<300>(1) == ones);
+	EXPECT_TRUE(ones*ones == Fixed<300>(1));
+	EXPECT_TRUE((Fixed<300>(1) << 299).bit(299));
+	EXPECT_TRUE((Fixed<300>(1) << 300).isZero());
+	EXPECT_TRUE(Fixed<300>(5) < (Fixed<300>(1) << 200));
+	EXPECT_TRUE(ones/(Fixed<300>(1) << 200) == (ones >> 200));
+	EXPECT_EQ((Fixed<300>(1) << 299).to_string(), "0x8" + std::string(74, '0'));
+	EXPECT_TRUE((Fixed<300>(7)/Fixed<300>()).isZero());
+}
+
+TEST(FixedPoint, Shift) {
+	// 12 stored as 3 shifted up by 2
+	Fixed<8, 2> x(3);
+	EXPECT_EQ(x.toReal(), 12.0);
+	EXPECT_EQ((x.as<8, 0>()).low(), 12u);
+	EXPECT_EQ((x.as<8, 3>()).low(), 1u);
+	EXPECT_EQ((x.as<4, -2>()).low(), 0u);
+	EXPECT_EQ((x.as<200, -100>() >> 100).low(), 12u);
+	EXPECT_EQ((Fixed<4, -1>(3)).toReal(), 1.5);
+}
@@ -0,0 +1,400 @@
+#include <algorithm>
+#include <set>
+
+#include <gtest/gtest.h>
+
+#include <flow/func.h>
+#include <flow/deadlock.h>
+#include <flow/flatten.h>
+#include <flow/graph.h>
+#include <flow/index.h>
+#include <flow/partition.h>
+#include <flow/specialize.h>
+#include <flow/synthesize.h>
+#include <flow/throughput.h>
+#include <flow/timing.h>
+
+using arithmetic::Expression;
+using arithmetic::Operand;
+using namespace flow;
+
+const size_t WIDTH = 16;
+
+Func makeSource(string name) {
+	Func func;
+	func.name = name;
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+
+	int branch0 = func.pushCond(Expression::boolOf(true));
+	func.conds[branch0].req(R, Expression::intOf(1));
+	return func;
+}
+
+Func makeBuffer(string name) {
+	Func func;
+	func.name = name;
+	Operand L = func.pushNet("L", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+
+	int branch0 = func.pushCond(Expression::boolOf(true));
+	func.conds[branch0].req(R, Expression(L));
+	func.conds[branch0].ack(L);
+	return func;
+}
+
+Func makeCopy(string name) {
+	Func func;
+	func.name = name;
+	Operand L = func.pushNet("L", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand R0 = func.pushNet("R0", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Operand R1 = func.pushNet("R1", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+
+	int branch0 = func.pushCond(Expression::boolOf(true));
+	func.conds[branch0].req(R0, Expression(L));
+	func.conds[branch0].req(R1, Expression(L));
+	func.conds[branch0].ack(L);
+	return func;
+}
+
+Func makeJoin(string name) {
+	Func func;
+	func.name = name;
+	Operand L0 = func.pushNet("L0", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand L1 = func.pushNet("L1", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+
+	int branch0 = func.pushCond(Expression::boolOf(true));
+	func.conds[branch0].req(R, Expression(L0) + Expression(L1));
+	func.conds[branch0].ack({L0, L1});
+	return func;
+}
+
+Func makeConst(string name, int value) {
+	Func func;
+	func.name = name;
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, 1), flow::Net::OUT);
+
+	int branch0 = func.pushCond(Expression::boolOf(true));
+	func.conds[branch0].req(R, Expression::intOf(value));
+	return func;
+}
+
+Func makeSplit(string name) {
+	Func func;
+	func.name = name;
+	Operand L = func.pushNet("L", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand C = func.pushNet("C", Type(Type::TypeName::FIXED, 1), flow::Net::IN);
+	Operand R0 = func.pushNet("R0", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Operand R1 = func.pushNet("R1", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+
+	int branch0 = func.pushCond(Expression(C) == Expression::intOf(0));
+	func.conds[branch0].req(R0, Expression(L));
+	func.conds[branch0].ack({C, L});
+
+	int branch1 = func.pushCond(Expression(C) == Expression::intOf(1));
+	func.conds[branch1].req(R1, Expression(L));
+	func.conds[branch1].ack({C, L});
+	return func;
+}
+
+void connect(Graph &graph, int from, int fromPort, int to, int toPort) {
+	Arc arc;
+	arc.from = from;
+	arc.fromPort = fromPort;
+	arc.to = to;
+	arc.toPort = toPort;
+	graph.arcs.push_back(arc);
+}
+
+TEST(GraphSynthesis, Dedup) {
+	Graph graph;
+	graph.funcs.push_back(makeBuffer("buffer0"));
+	graph.funcs.push_back(makeCopy("copy"));
+	graph.funcs.push_back(makeBuffer("buffer1"));
+	graph.nodes = {0, 1, 2, 2, 0};
+
+	EXPECT_EQ(graph.funcs[0].structuralHash(), graph.funcs[2].structuralHash());
+	EXPECT_NE(graph.funcs[0].structuralKey(), graph.funcs[1].structuralKey());
+
+	vector<int> nodes;
+	vector<clocked::Module> mods = synthesizeModulesFromGraph(graph, nodes);
+	ASSERT_EQ(mods.size(), 2u);
+	EXPECT_EQ(nodes, (vector<int>{0, 1, 0, 0, 0}));
+	// the Graph itself is left alone
+	EXPECT_EQ(graph.funcs.size(), 3u);
+	EXPECT_EQ(graph.nodes, (vector<int>{0, 1, 2, 2, 0}));
+	EXPECT_EQ(mods[0].name, "buffer0");
+	EXPECT_EQ(mods[1].name, "copy");
+}
+
+TEST(GraphAnalysis, Throughput) {
+	Graph graph;
+	graph.funcs.push_back(makeSource("source"));
+	graph.funcs.push_back(makeBuffer("buffer"));
+	graph.nodes = {0, 1, 1, 1};
+	connect(graph, 0, 0, 1, 0);
+	connect(graph, 1, 1, 2, 0);
+	connect(graph, 2, 1, 3, 0);
+
+	// a plain pipeline runs at one token per cycle
+	ThroughputReport report = analyzeThroughput(graph);
+	EXPECT_FALSE(report.deadlock);
+	EXPECT_DOUBLE_EQ(report.cycleRatio, 1.0);
+
+	// closing a ring with no tokens in it can never fire
+	connect(graph, 3, 1, 1, 0);
+	report = analyzeThroughput(graph);
+	EXPECT_TRUE(report.deadlock);
+	EXPECT_EQ(report.criticalNodes.size(), 3u);
+}
+
+TEST(GraphAnalysis, BufferDepths) {
+	Graph graph;
+	graph.funcs.push_back(makeCopy("copy"));
+	graph.funcs.push_back(makeBuffer("buffer"));
+	graph.funcs.push_back(makeJoin("join"));
+	graph.nodes = {0, 1, 1, 2};
+	connect(graph, 0, 1, 1, 0);
+	connect(graph, 1, 1, 2, 0);
+	connect(graph, 2, 1, 3, 0);
+	connect(graph, 0, 2, 3, 1);
+
+	// the short side of the fork holds a single slot while tokens are in
+	// flight on the long side
+	ThroughputReport report = analyzeThroughput(graph);
+	EXPECT_DOUBLE_EQ(report.cycleRatio, 3.0);
+
+	vector<int> depths = recommendBufferDepths(graph, 1.0);
+	EXPECT_EQ(depths, (vector<int>{1, 1, 1, 3}));
+	EXPECT_DOUBLE_EQ(analyzeThroughput(graph, depths).throughput, 1.0);
+}
+
+TEST(GraphAnalysis, Index) {
+	Graph graph;
+	graph.funcs.push_back(makeCopy("copy"));
+	graph.funcs.push_back(makeBuffer("buffer"));
+	graph.funcs.push_back(makeJoin("join"));
+	graph.nodes = {0, 1, 1, 2, 1};
+	connect(graph, 0, 2, 3, 1);
+	connect(graph, 0, 1, 1, 0);
+	connect(graph, 1, 1, 2, 0);
+	connect(graph, 2, 1, 3, 0);
+	connect(graph, 3, 2, 4, 0);
+
+	GraphIndex index(graph);
+	ASSERT_EQ(index.fanout(0).size(), 2u);
+	EXPECT_EQ(index.fanout(0)[0], 1);
+	EXPECT_EQ(index.fanout(0)[1], 0);
+	EXPECT_EQ(index.fanin(3).size(), 2u);
+	EXPECT_EQ(index.arcFrom(0, 2), 0);
+	EXPECT_EQ(index.arcTo(3, 0), 3);
+	EXPECT_EQ(index.arcTo(3, 2), -1);
+	EXPECT_EQ(index.arcFrom(4, 1), -1);
+
+	EXPECT_EQ(topologicalSort(index), (vector<int>{0, 1, 2, 3, 4}));
+	EXPECT_EQ(breadthFirstSearch(index, {0}), (vector<int>{0, 1, 2, 1, 2}));
+	EXPECT_EQ(breadthFirstSearch(index, {4}, false), (vector<int>{2, 3, 2, 1, 0}));
+
+	vector<int> component;
+	EXPECT_EQ(stronglyConnectedComponents(index, component), 5);
+
+	// closing the loop through the buffers puts them in one component
+	connect(graph, 2, 2, 1, 1);
+	index = GraphIndex(graph);
+	EXPECT_EQ(topologicalSort(index), (vector<int>{0}));
+	EXPECT_EQ(stronglyConnectedComponents(index, component), 4);
+	EXPECT_EQ(component[1], component[2]);
+	EXPECT_NE(component[0], component[1]);
+	EXPECT_GT(component[0], component[1]);
+	EXPECT_GT(component[1], component[3]);
+
+	// arcs start out unconnected
+	Arc arc;
+	EXPECT_EQ(arc.from, -1);
+	EXPECT_EQ(arc.toPort, -1);
+}
+
+TEST(GraphSynthesis, Flatten) {
+	Graph graph;
+	graph.funcs.push_back(makeSource("source"));
+	graph.funcs.push_back(makeBuffer("buffer"));
+	graph.nodes = {0, 1, 1};
+	connect(graph, 0, 0, 1, 0);
+	connect(graph, 1, 1, 2, 0);
+
+	clocked::Module top = synthesizeModuleFromGraph(graph);
+	EXPECT_EQ(top.name, "top");
+	EXPECT_EQ(top.nets[top.clk].purpose, clocked::Net::Purpose::IN);
+
+	// every node shares the one clock
+	int clocks = 0;
+	for (auto net = top.nets.begin(); net != top.nets.end(); net++) {
+		clocks += (net->name.find("clk") != string::npos);
+	}
+	EXPECT_EQ(clocks, 1);
+
+	// connected ports become wires, the valid of the source drives the
+	// valid of the first buffer and the ready goes the other way
+	int sourceValid = top.netIndex("source_0_R_valid");
+	int bufferValid = top.netIndex("buffer_1_L_valid");
+	int bufferReady = top.netIndex("buffer_1_L_ready");
+	int sourceReady = top.netIndex("source_0_R_ready");
+	ASSERT_GE(sourceValid, 0);
+	ASSERT_GE(bufferValid, 0);
+	EXPECT_EQ(top.nets[sourceValid].purpose, clocked::Net::Purpose::WIRE);
+	EXPECT_EQ(top.nets[bufferValid].purpose, clocked::Net::Purpose::WIRE);
+
+	bool validDriven = false, readyDriven = false;
+	for (auto assign = top.assign.begin(); assign != top.assign.end(); assign++) {
+		validDriven = validDriven or (assign->net == bufferValid and assign->expr.top.isVar() and (int)assign->expr.top.index == sourceValid);
+		readyDriven = readyDriven or (assign->net == sourceReady and assign->expr.top.isVar() and (int)assign->expr.top.index == bufferReady);
+	}
+	EXPECT_TRUE(validDriven);
+	EXPECT_TRUE(readyDriven);
+
+	// the last output is left as a port of the top level
+	EXPECT_EQ(top.nets[top.netIndex("buffer_2_R_valid")].purpose, clocked::Net::Purpose::OUT);
+	EXPECT_EQ(top.nets[top.netIndex("buffer_2_R_ready")].purpose, clocked::Net::Purpose::IN);
+	EXPECT_EQ(top.blocks.size(), synthesizeModuleFromFunc(makeSource("source")).blocks.size() + 2*synthesizeModuleFromFunc(makeBuffer("buffer")).blocks.size());
+	EXPECT_TRUE(clocked::analyzeTiming(top).loops.empty());
+}
+
+TEST(GraphOptimization, Specialize) {
+	Graph graph;
+	graph.funcs.push_back(makeSource("source"));
+	graph.funcs.push_back(makeConst("zero", 0));
+	graph.funcs.push_back(makeSplit("split"));
+	graph.nodes = {0, 1, 2, 0, 2};
+	connect(graph, 0, 0, 2, 0);
+	connect(graph, 1, 0, 2, 1);
+	connect(graph, 3, 0, 4, 0);
+
+	// only the first split has its control tied to a constant
+	vector<Range> ranges = propagateRanges(graph);
+	ASSERT_EQ(ranges.size(), 3u);
+	EXPECT_EQ(ranges[1].lo, 0);
+	EXPECT_EQ(ranges[1].hi, 0);
+	EXPECT_EQ(ranges[0].lo, 1);
+	EXPECT_EQ(ranges[0].hi, 1);
+
+	EXPECT_EQ(specializeGraph(graph), 1);
+	ASSERT_EQ(graph.funcs.size(), 4u);
+	EXPECT_NE(graph.nodes[2], graph.nodes[4]);
+	EXPECT_EQ(graph.nodes[0], graph.nodes[3]);
+	EXPECT_EQ(graph.funcs[graph.nodes[2]].conds.size(), 1u);
+	EXPECT_EQ(graph.funcs[graph.nodes[4]].conds.size(), 2u);
+	EXPECT_EQ(graph.funcs[graph.nodes[2]].name, "split_2");
+
+	// every Func becomes a Module, so no two may share a name
+	set<string> names;
+	for (auto func = graph.funcs.begin(); func != graph.funcs.end(); func++) {
+		EXPECT_TRUE(names.insert(func->name).second);
+	}
+
+	// the ports stay put so the arcs still line up
+	EXPECT_EQ(graph.funcs[graph.nodes[2]].nets.size(), graph.funcs[graph.nodes[4]].nets.size());
+}
+
+TEST(GraphAnalysis, Partition) {
+	// two rings of eight buffers joined by a single arc
+	Graph graph;
+	graph.funcs.push_back(makeBuffer("buffer"));
+	graph.nodes.assign(16, 0);
+	for (int ring = 0; ring < 2; ring++) {
+		for (int i = 0; i < 8; i++) {
+			connect(graph, ring*8 + i, 1, ring*8 + (i+1)%8, 0);
+			connect(graph, ring*8 + i, 1, ring*8 + (i+3)%8, 0);
+		}
+	}
+	connect(graph, 3, 1, 12, 0);
+
+	vector<int> part = partitionGraph(graph, 2);
+	ASSERT_EQ(part.size(), 16u);
+	EXPECT_EQ(countCutArcs(graph, part), 1);
+	for (int i = 1; i < 8; i++) {
+		EXPECT_EQ(part[i], part[0]);
+		EXPECT_EQ(part[8+i], part[8]);
+	}
+	EXPECT_NE(part[0], part[8]);
+
+	// every part gets its share of the weight
+	part = partitionGraph(graph, 4, vector<int>(16, 1));
+	vector<int> sizes(4, 0);
+	for (auto p = part.begin(); p != part.end(); p++) {
+		ASSERT_GE(*p, 0);
+		ASSERT_LT(*p, 4);
+		sizes[*p]++;
+	}
+	EXPECT_EQ(sizes, (vector<int>{4, 4, 4, 4}));
+
+	EXPECT_EQ(nodeCosts(graph, NodeCost::CONDITIONS), vector<int>(16, 1));
+
+	// the path 2-0-4-6-1-7 with 3 off of 6 and 5 on its own. Every grown
+	// split cuts two arcs. At four nodes a side the balance has no room
+	// for a single move, so refinement has to go one node over and come
+	// back to find the split that cuts one.
+	Graph path;
+	path.funcs.push_back(makeBuffer("buffer"));
+	path.nodes.assign(8, 0);
+	connect(path, 2, 1, 0, 0);
+	connect(path, 0, 1, 4, 0);
+	connect(path, 4, 1, 6, 0);
+	connect(path, 6, 1, 1, 0);
+	connect(path, 1, 1, 7, 0);
+	connect(path, 6, 1, 3, 0);
+	part = partitionGraph(path, 2, vector<int>(8, 1));
+	EXPECT_EQ(countCutArcs(path, part), 1);
+	EXPECT_EQ(std::count(part.begin(), part.end(), 0), 4);
+}
+
+TEST(GraphAnalysis, Deadlock) {
+	Graph graph;
+	graph.funcs.push_back(makeSource("source"));
+	graph.funcs.push_back(makeBuffer("buffer"));
+	graph.funcs.push_back(makeJoin("join"));
+	graph.nodes = {0, 1, 1, 1};
+	connect(graph, 0, 0, 1, 0);
+	connect(graph, 1, 1, 2, 0);
+	connect(graph, 2, 1, 3, 0);
+
+	// every arc of a pipeline is independently full or empty
+	DeadlockReport report = findDeadlock(graph);
+	EXPECT_FALSE(report.deadlock);
+	EXPECT_TRUE(report.complete);
+	EXPECT_EQ(report.states, 8);
+
+	// threads racing to insert the same state count it once
+	Graph longer;
+	longer.funcs = graph.funcs;
+	longer.nodes.assign(15, 1);
+	longer.nodes[0] = 0;
+	for (int node = 0; node+1 < 15; node++) {
+		connect(longer, node, node == 0 ? 0 : 1, node+1, 0);
+	}
+	report = findDeadlock(longer, (int64_t)1 << 20, 4);
+	EXPECT_TRUE(report.complete);
+	EXPECT_EQ(report.states, 1 << 14);
+
+	// a ring with no tokens in it is stuck from reset
+	Graph ring = graph;
+	ring.arcs.erase(ring.arcs.begin());
+	connect(ring, 3, 1, 1, 0);
+	report = findDeadlock(ring, 1024, 1);
+	EXPECT_TRUE(report.deadlock);
+	EXPECT_TRUE(report.trace.empty());
+
+	// a join waiting on its own output gets stuck after its other input
+	// arrives
+	Graph loop;
+	loop.funcs = graph.funcs;
+	loop.nodes = {0, 2, 1};
+	connect(loop, 0, 0, 1, 0);
+	connect(loop, 1, 2, 2, 0);
+	connect(loop, 2, 1, 1, 1);
+	report = findDeadlock(loop, 1024, 4);
+	ASSERT_TRUE(report.deadlock);
+	ASSERT_EQ(report.trace.size(), 1u);
+	EXPECT_EQ(report.trace[0].node, 0);
+	EXPECT_EQ(report.tokens, (vector<int>{1, 0, 0}));
+	EXPECT_EQ(report.branches, (vector<int>{0, 0, 0}));
+}
@@ -0,0 +1,200 @@
+#include <gtest/gtest.h>
+
+#include <flow/func.h>
+#include <flow/optimize.h>
+#include <flow/width.h>
+
+using arithmetic::Expression;
+using arithmetic::Operand;
+using arithmetic::Operation;
+using namespace flow;
+
+const size_t WIDTH = 16;
+
+TEST(FuncOptimization, DeadNets) {
+	Func func;
+	func.name = "dead_nets";
+	Operand L = func.pushNet("L", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand unused = func.pushNet("unused", Type(Type::TypeName::FIXED, WIDTH), flow::Net::REG);
+	Operand self = func.pushNet("self", Type(Type::TypeName::FIXED, WIDTH), flow::Net::REG);
+	Operand idle = func.pushNet("idle", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Operand m = func.pushNet("m", Type(Type::TypeName::FIXED, WIDTH), flow::Net::REG);
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Expression exprL(L);
+	Expression exprm(m);
+	Expression exprself(self);
+
+	int branch0 = func.pushCond(Expression::boolOf(false));
+	func.conds[branch0].req(idle, exprL);
+	func.conds[branch0].ack(L);
+
+	int branch1 = func.pushCond(Expression::boolOf(true));
+	func.conds[branch1].req(R, exprL + exprm);
+	func.conds[branch1].mem(m, exprL);
+	func.conds[branch1].mem(self, exprself + exprL);
+	func.conds[branch1].ack(L);
+
+	vector<int> netMap = optimizeFunc(func);
+
+	ASSERT_EQ(func.conds.size(), 1u);
+	ASSERT_EQ(func.nets.size(), 4u);
+	EXPECT_EQ(netMap[unused.index], -1);
+	EXPECT_EQ(netMap[self.index], -1);
+	EXPECT_EQ(netMap[idle.index], -1);
+	EXPECT_EQ(func.netAt(netMap[L.index]), "L");
+	EXPECT_EQ(func.netAt(netMap[m.index]), "m");
+	EXPECT_EQ(func.netAt(netMap[R.index]), "R");
+
+	// the surviving COND net is renumbered along with its Condition
+	const Condition &cond = func.conds[0];
+	EXPECT_EQ(func.nets[cond.uid].purpose, flow::Net::COND);
+	EXPECT_EQ(func.netAt(cond.uid), "branch_0");
+	ASSERT_EQ(cond.regs.size(), 1u);
+	EXPECT_EQ(cond.regs[0].first, netMap[m.index]);
+	ASSERT_EQ(cond.outs.size(), 1u);
+	EXPECT_EQ(cond.outs[0].first, netMap[R.index]);
+	EXPECT_EQ(getNetsInExpression(cond.outs[0].second),
+		(set<size_t>{(size_t)netMap[L.index], (size_t)netMap[m.index]}));
+}
+
+TEST(FuncOptimization, MergeConds) {
+	Func func;
+	func.name = "merge_conds";
+	Operand L = func.pushNet("L", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand C = func.pushNet("C", Type(Type::TypeName::FIXED, 2), flow::Net::IN);
+	Operand R0 = func.pushNet("R0", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Operand R1 = func.pushNet("R1", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Expression exprL(L);
+	Expression exprC(C);
+
+	int branch0 = func.pushCond(exprC == Expression::intOf(0));
+	func.conds[branch0].req(R0, exprL);
+	func.conds[branch0].ack({C, L});
+
+	int branch1 = func.pushCond(exprC == Expression::intOf(1));
+	func.conds[branch1].req(R1, exprL);
+	func.conds[branch1].ack({C, L});
+
+	int branch2 = func.pushCond(exprC == Expression::intOf(2));
+	func.conds[branch2].req(R0, exprL);
+	func.conds[branch2].ack({L, C});
+
+	EXPECT_TRUE(haveSameActions(func.conds[branch0], func.conds[branch2]));
+	EXPECT_FALSE(haveSameActions(func.conds[branch0], func.conds[branch1]));
+
+	EXPECT_EQ(mergeConds(func), 1);
+	ASSERT_EQ(func.conds.size(), 2u);
+	EXPECT_TRUE(areSame(func.conds[0].valid, (exprC == Expression::intOf(0)) || (exprC == Expression::intOf(2))));
+
+	optimizeFunc(func);
+	EXPECT_EQ(func.nets.size(), 6u);
+	EXPECT_EQ(func.netAt(func.conds[1].uid), "branch_1");
+}
+
+TEST(FuncOptimization, PrioritizeConds) {
+	Func func;
+	func.name = "prioritize_conds";
+	Operand L = func.pushNet("L", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand C = func.pushNet("C", Type(Type::TypeName::FIXED, 2), flow::Net::IN);
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Expression exprL(L);
+	Expression exprC(C);
+
+	for (int i = 0; i < 3; i++) {
+		int branch = func.pushCond(exprC == Expression::intOf(i));
+		func.conds[branch].req(R, exprL + Expression::intOf(i));
+		func.conds[branch].ack({C, L});
+	}
+	// overlaps with all of the others, so it can't pass any of them
+	int fallback = func.pushCond(exprL == Expression::intOf(0));
+	func.conds[fallback].req(R, exprL);
+	func.conds[fallback].ack(L);
+
+	EXPECT_EQ(prioritizeConds(func, {}), (vector<int>{0, 1, 2, 3}));
+	EXPECT_EQ(prioritizeConds(func, {1, 50, 10, 100}), (vector<int>{1, 2, 0, 3}));
+	EXPECT_EQ(prioritizeConds(func, {0, 5, 5}), (vector<int>{1, 2, 0, 3}));
+}
+
+TEST(FuncOptimization, NarrowWidths) {
+	Func func;
+	func.name = "narrow_widths";
+	Operand Ad = func.pushNet("Ad", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand Bd = func.pushNet("Bd", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand Sd = func.pushNet("Sd", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Operand Sc = func.pushNet("Sc", Type(Type::TypeName::FIXED, 1), flow::Net::OUT);
+	Operand ci = func.pushNet("ci", Type(Type::TypeName::FIXED, WIDTH), flow::Net::REG);
+	Operand Sn = func.pushNet("Sn", Type(Type::TypeName::FIXED, 8), flow::Net::OUT);
+	Operand count = func.pushNet("count", Type(Type::TypeName::FIXED, 2), flow::Net::REG);
+	Operand masked = func.pushNet("masked", Type(Type::TypeName::FIXED, 3), flow::Net::REG);
+	Operand overflow = func.pushNet("overflow", Type(Type::TypeName::FIXED, 2), flow::Net::REG);
+	Expression expr_Ad(Ad);
+	Expression expr_Bd(Bd);
+	Expression expr_ci(ci);
+
+	int branch0 = func.pushCond(Expression::boolOf(true));
+	func.conds[branch0].req(Sd, (expr_Ad + expr_Bd + expr_ci) % Expression::intOf(65536));
+	func.conds[branch0].req(Sc, expr_ci + Expression::intOf(1));
+	func.conds[branch0].mem(ci, (expr_Ad + expr_Bd + expr_ci) / Expression::intOf(65536));
+	// these wrap on purpose, overflow and Sn drop their top bits
+	func.conds[branch0].mem(count, (Expression(count) + Expression::intOf(1)) % Expression::intOf(4));
+	func.conds[branch0].mem(masked, (Expression(masked) + Expression::intOf(3)) & Expression::intOf(7));
+	func.conds[branch0].mem(overflow, Expression(overflow) + Expression::intOf(1));
+	func.conds[branch0].req(Sn, expr_Ad | expr_Bd);
+	func.conds[branch0].ack({Ad, Bd});
+
+	vector<Range> ranges = inferRanges(func);
+	EXPECT_EQ(ranges[ci.index].hi, 1);
+	EXPECT_EQ(ranges[Sd.index].width, (int)WIDTH);
+
+	vector<WidthReport> reports = narrowWidths(func);
+	EXPECT_EQ(func.nets[ci.index].type.width, 1);
+	EXPECT_EQ(func.nets[Sd.index].type.width, (int)WIDTH);
+	EXPECT_EQ(func.nets[count.index].type.width, 2);
+	EXPECT_EQ(func.nets[masked.index].type.width, 3);
+	ASSERT_EQ(reports.size(), 3u);
+	EXPECT_EQ(reports[0].net, (int)Sc.index);
+	EXPECT_EQ(reports[0].declared, 1);
+	EXPECT_EQ(reports[0].required, 2);
+	EXPECT_EQ(reports[1].net, (int)Sn.index);
+	EXPECT_EQ(reports[1].declared, 8);
+	EXPECT_EQ(reports[1].required, (int)WIDTH);
+	EXPECT_EQ(reports[2].net, (int)overflow.index);
+	EXPECT_EQ(reports[2].declared, 2);
+	EXPECT_EQ(reports[2].required, 3);
+	EXPECT_EQ(func.nets[overflow.index].type.width, 2);
+
+	// wide shift amounts saturate instead of overflowing
+	Range shifted = rangeOfOperation(Operation::OpType::LEFT_SHIFT, {Range(1, 1), Range(0, ((int64_t)1 << 39))});
+	EXPECT_FALSE(shifted.bounded);
+	EXPECT_GT(shifted.width, 64);
+}
+
+TEST(FuncOptimization, StrengthReduction) {
+	Func func;
+	func.name = "strength_reduction";
+	Operand L = func.pushNet("L", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Operand acc = func.pushNet("acc", Type(Type::TypeName::FIXED, WIDTH), flow::Net::REG);
+	Expression exprL(L);
+	Expression exprAcc(acc);
+
+	Expression reduced = reduceStrength((exprL / Expression::intOf(4)) % Expression::intOf(16));
+	ASSERT_TRUE(reduced.top.isExpr());
+	EXPECT_EQ(reduced.getExpr(reduced.top.index)->func, Operation::OpType::BITWISE_AND);
+	EXPECT_TRUE(areSame(reduceStrength(exprL * Expression::intOf(3)), exprL * Expression::intOf(3)));
+
+	int branch0 = func.pushCond(Expression::boolOf(true));
+	func.conds[branch0].req(R, exprAcc);
+	func.conds[branch0].mem(acc, Expression::intOf(4) * exprL);
+	func.conds[branch0].ack(L);
+
+	reduceStrength(func);
+	EXPECT_EQ(foldRegisterShifts(func), 1);
+	EXPECT_EQ(func.nets[acc.index].type.width, (int)WIDTH-2);
+	EXPECT_EQ(func.nets[acc.index].type.shift, 0);
+	EXPECT_TRUE(areSame(func.conds[0].regs[0].second, exprL));
+
+	const Expression &read = func.conds[0].outs[0].second;
+	ASSERT_TRUE(read.top.isExpr());
+	EXPECT_EQ(read.getExpr(read.top.index)->func, Operation::OpType::LEFT_SHIFT);
+}
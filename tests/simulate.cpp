@@ -0,0 +1,294 @@
+#include <gtest/gtest.h>
+
+#include <flow/func.h>
+#include <flow/module.h>
+#include <flow/simulate.h>
+#include <flow/synthesize.h>
+
+using arithmetic::Expression;
+using namespace clocked;
+
+TEST(BatchSimulation, Counter) {
+	Module mod;
+	mod.name = "counter";
+	mod.clk = mod.pushNet("clk", Type(Type::TypeName::BITS, 1), Net::Purpose::IN);
+	mod.reset = mod.pushNet("reset", Type(Type::TypeName::BITS, 1), Net::Purpose::IN);
+	int inc = mod.pushNet("inc", Type(Type::TypeName::FIXED, 4), Net::Purpose::IN);
+	int count = mod.pushNet("count", Type(Type::TypeName::FIXED, 8), Net::Purpose::REG);
+	int odd = mod.pushNet("odd", Type(Type::TypeName::FIXED, 1), Net::Purpose::OUT);
+
+	mod.assign.push_back(Assign(odd, Expression::varOf(count) & Expression::intOf(1), true));
+	mod.blocks.push_back(Block(Expression::varOf(mod.clk)));
+	mod.blocks.back().reset.push_back(Assign(count, Expression::intOf(0)));
+	mod.blocks.back().rules.push_back(Rule({
+		Assign(count, Expression::varOf(count) + Expression::varOf(inc)),
+	}));
+
+	const int lanes = 1000;
+	BatchSimulator sim(mod, lanes);
+	EXPECT_TRUE(sim.errors.empty());
+
+	sim.setAll(mod.reset, 1);
+	sim.step();
+	sim.setAll(mod.reset, 0);
+	for (int lane = 0; lane < lanes; lane++) {
+		sim.set(inc, lane, lane);
+	}
+	sim.step(100);
+	sim.evaluate();
+
+	// every lane counts by its own increment, wrapping at 8 bits
+	for (int lane = 0; lane < lanes; lane++) {
+		EXPECT_EQ(sim.get(inc, lane), (uint64_t)(lane%16));
+		EXPECT_EQ(sim.get(count, lane), (uint64_t)((lane%16)*100%256));
+		EXPECT_EQ(sim.get(odd, lane), (uint64_t)((lane%16)*100%2));
+	}
+
+	// a net the lanes can't hold refuses the whole Module
+	mod.pushNet("wide", Type(Type::TypeName::FIXED, 65), Net::Purpose::REG);
+	BatchSimulator wide(mod, lanes);
+	EXPECT_EQ(wide.mod, nullptr);
+	EXPECT_EQ(wide.lanes, 0);
+	ASSERT_EQ(wide.errors.size(), 1u);
+	EXPECT_EQ(wide.errors[0], "wide is 65 bits wide");
+	wide.step(10);
+}
+
+TEST(BatchSimulation, Rules) {
+	Module mod;
+	mod.name = "rules";
+	mod.clk = mod.pushNet("clk", Type(Type::TypeName::BITS, 1), Net::Purpose::IN);
+	mod.reset = mod.pushNet("reset", Type(Type::TypeName::BITS, 1), Net::Purpose::IN);
+	int sel = mod.pushNet("sel", Type(Type::TypeName::FIXED, 2), Net::Purpose::IN);
+	int first = mod.pushNet("first", Type(Type::TypeName::FIXED, 4), Net::Purpose::REG);
+	int last = mod.pushNet("last", Type(Type::TypeName::FIXED, 4), Net::Purpose::REG);
+	int flag = mod.pushNet("flag", Type(Type::TypeName::FIXED, 1), Net::Purpose::REG);
+	Expression s = Expression::varOf(sel);
+
+	mod.blocks.push_back(Block(Expression::varOf(mod.clk)));
+	Block &always = mod.blocks.back();
+	// sel > 0 shadows sel > 1 in the chain, parallel rules all fire and the
+	// later write wins
+	always.rules.push_back(Rule({Assign(first, Expression::intOf(1))}, s > Expression::intOf(0)));
+	always.rules.push_back(Rule({Assign(first, Expression::intOf(2))}, s > Expression::intOf(1)));
+	always.rules.back().isChained = true;
+	always.rules.push_back(Rule({Assign(last, Expression::intOf(3))}, s > Expression::intOf(0)));
+	always.rules.push_back(Rule({Assign(last, Expression::intOf(4))}, s > Expression::intOf(1)));
+	always._else.push_back(Rule({Assign(flag, ~Expression::varOf(flag))}));
+
+	BatchSimulator sim(mod, 4);
+	EXPECT_TRUE(sim.errors.empty());
+	for (int lane = 0; lane < 4; lane++) {
+		sim.set(sel, lane, lane);
+	}
+	sim.step();
+
+	EXPECT_EQ(sim.get(first, 0), 0u);
+	EXPECT_EQ(sim.get(first, 1), 1u);
+	EXPECT_EQ(sim.get(first, 3), 1u);
+	EXPECT_EQ(sim.get(last, 1), 3u);
+	EXPECT_EQ(sim.get(last, 2), 4u);
+	EXPECT_EQ(sim.get(flag, 0), 1u);
+	EXPECT_EQ(sim.get(flag, 2), 0u);
+}
+
+TEST(BatchSimulation, Synthesized) {
+	flow::Func func;
+	func.name = "increment";
+	Operand L = func.pushNet("L", flow::Type(flow::Type::TypeName::FIXED, 16), flow::Net::IN);
+	Operand R = func.pushNet("R", flow::Type(flow::Type::TypeName::FIXED, 16), flow::Net::OUT);
+	int branch = func.pushCond(Expression::boolOf(true));
+	func.conds[branch].req(R, Expression(L) + Expression::intOf(1));
+	func.conds[branch].ack(L);
+
+	Module mod = flow::synthesizeModuleFromFunc(func);
+	const int lanes = 512;
+	BatchSimulator sim(mod, lanes);
+	EXPECT_TRUE(sim.errors.empty());
+
+	int L_valid = mod.netIndex("L_valid");
+	int L_data = mod.netIndex("L_data");
+	int R_valid = mod.netIndex("R_valid");
+	int R_ready = mod.netIndex("R_ready");
+	int R_data = mod.netIndex("R_data");
+	sim.setAll(mod.reset, 1);
+	sim.step();
+	sim.setAll(mod.reset, 0);
+
+	// a token on every lane, consumed only where the output is ready
+	sim.setAll(L_valid, 1);
+	for (int lane = 0; lane < lanes; lane++) {
+		sim.set(L_data, lane, lane*3);
+		sim.set(R_ready, lane, lane%2);
+	}
+	sim.step(3);
+	sim.evaluate();
+	for (int lane = 0; lane < lanes; lane++) {
+		EXPECT_EQ(sim.get(R_valid, lane), 1u);
+		EXPECT_EQ(sim.get(R_data, lane), (uint64_t)(lane*3 + 1));
+	}
+}
+
+TEST(BatchSimulation, BranchProfile) {
+	flow::Func func;
+	func.name = "select";
+	Operand L = func.pushNet("L", flow::Type(flow::Type::TypeName::FIXED, 16), flow::Net::IN);
+	Operand C = func.pushNet("C", flow::Type(flow::Type::TypeName::FIXED, 2), flow::Net::IN);
+	Operand R = func.pushNet("R", flow::Type(flow::Type::TypeName::FIXED, 16), flow::Net::OUT);
+	for (int i = 0; i < 4; i++) {
+		int branch = func.pushCond(Expression(C) == Expression::intOf(i));
+		func.conds[branch].req(R, Expression(L) + Expression::intOf(i));
+		func.conds[branch].ack({C, L});
+	}
+
+	// chaining the reordered rules doesn't change what the Module does
+	flow::SynthesisOptions options;
+	options.branchProfile = {3, 1, 40, 7};
+	Module plain = flow::synthesizeModuleFromFunc(func);
+	Module chained = flow::synthesizeModuleFromFunc(func, options);
+	ASSERT_EQ(chained.blocks.front().rules.size(), 4u);
+	EXPECT_TRUE(chained.blocks.front().rules.back().isChained);
+
+	const int lanes = 64;
+	BatchSimulator a(plain, lanes), b(chained, lanes);
+	EXPECT_TRUE(a.errors.empty());
+	EXPECT_TRUE(b.errors.empty());
+	vector<string> ports = {"L_valid", "L_data", "C_valid", "C_data", "R_ready"};
+	vector<string> watched = {"L_ready", "C_ready", "R_valid", "R_data"};
+	for (BatchSimulator *sim : {&a, &b}) {
+		sim->setAll(sim->mod->reset, 1);
+		sim->step();
+		sim->setAll(sim->mod->reset, 0);
+	}
+	for (int cycle = 0; cycle < 64; cycle++) {
+		for (BatchSimulator *sim : {&a, &b}) {
+			for (int lane = 0; lane < lanes; lane++) {
+				vector<uint64_t> values = {(uint64_t)(lane + cycle)%3 != 0, (uint64_t)(lane*5 + cycle),
+					1, (uint64_t)(lane + cycle/3)%4, (uint64_t)(cycle + lane/2)%2};
+				for (size_t p = 0; p < ports.size(); p++) {
+					sim->set(sim->mod->netIndex(ports[p]), lane, values[p]);
+				}
+			}
+			sim->evaluate();
+		}
+		for (auto name = watched.begin(); name != watched.end(); name++) {
+			for (int lane = 0; lane < lanes; lane++) {
+				EXPECT_EQ(a.get(plain.netIndex(*name), lane), b.get(chained.netIndex(*name), lane));
+			}
+		}
+		a.tick();
+		b.tick();
+	}
+}
+
+TEST(BatchSimulation, PerfCounters) {
+	flow::Func func;
+	func.name = "counted";
+	Operand L = func.pushNet("L", flow::Type(flow::Type::TypeName::FIXED, 16), flow::Net::IN);
+	Operand R = func.pushNet("R", flow::Type(flow::Type::TypeName::FIXED, 16), flow::Net::OUT);
+	func.nets[L.index].protocol = flow::Net::CREDIT;
+	func.nets[L.index].credits = 2;
+	func.nets[R.index].buffering = flow::Net::FIFO;
+	func.nets[R.index].depth = 3;
+	int branch = func.pushCond(Expression::boolOf(true));
+	func.conds[branch].req(R, Expression(L));
+	func.conds[branch].ack(L);
+
+	flow::SynthesisOptions options;
+	options.perfCounters = true;
+	Module mod = flow::synthesizeModuleFromFunc(func, options);
+	const int lanes = 16;
+	BatchSimulator sim(mod, lanes);
+	EXPECT_TRUE(sim.errors.empty());
+
+	int L_valid = mod.netIndex("L_valid");
+	int L_credit = mod.netIndex("L_credit");
+	int R_valid = mod.netIndex("R_valid");
+	int R_ready = mod.netIndex("R_ready");
+	sim.setAll(mod.reset, 1);
+	sim.step();
+	sim.setAll(mod.reset, 0);
+
+	// every lane sends while it holds credits and drains at its own pace,
+	// the counters have to agree with the handshake on the ports
+	vector<string> names = {"L_credit", "L_idle", "L_xfer", "R_stall", "R_idle", "R_xfer"};
+	vector<vector<uint64_t> > expected(names.size(), vector<uint64_t>(lanes, 0));
+	vector<int> credits(lanes, 2);
+	for (int cycle = 0; cycle < 300; cycle++) {
+		for (int lane = 0; lane < lanes; lane++) {
+			sim.set(L_valid, lane, credits[lane] > 0 and (cycle + lane)%3 != 0);
+			sim.set(R_ready, lane, (cycle/(lane%4 + 1) + lane)%2);
+		}
+		sim.evaluate();
+		for (int lane = 0; lane < lanes; lane++) {
+			uint64_t lv = sim.get(L_valid, lane), lc = sim.get(L_credit, lane);
+			uint64_t rv = sim.get(R_valid, lane), rr = sim.get(R_ready, lane);
+			vector<uint64_t> events = {lc, not lv, lv, rv and not rr, rr and not rv, rv and rr};
+			for (size_t e = 0; e < events.size(); e++) {
+				expected[e][lane] += events[e];
+			}
+			credits[lane] += (int)lc - (int)lv;
+		}
+		sim.tick();
+	}
+
+	for (size_t e = 0; e < names.size(); e++) {
+		int counter = mod.netIndex("perf_" + names[e]);
+		ASSERT_GE(counter, 0);
+		for (int lane = 0; lane < lanes; lane++) {
+			EXPECT_EQ(sim.get(counter, lane), expected[e][lane]);
+		}
+	}
+	EXPECT_GT(expected[5][0], 20u);
+}
+
+TEST(BatchSimulation, Fifo) {
+	flow::Func func;
+	func.name = "fifo";
+	Operand L = func.pushNet("L", flow::Type(flow::Type::TypeName::FIXED, 16), flow::Net::IN);
+	Operand R = func.pushNet("R", flow::Type(flow::Type::TypeName::FIXED, 16), flow::Net::OUT);
+	func.nets[R.index].buffering = flow::Net::FIFO;
+	func.nets[R.index].depth = 3;
+	int branch = func.pushCond(Expression::boolOf(true));
+	func.conds[branch].req(R, Expression(L));
+	func.conds[branch].ack(L);
+
+	Module mod = flow::synthesizeModuleFromFunc(func);
+	const int lanes = 16;
+	BatchSimulator sim(mod, lanes);
+	EXPECT_TRUE(sim.errors.empty());
+
+	int L_valid = mod.netIndex("L_valid");
+	int L_ready = mod.netIndex("L_ready");
+	int L_data = mod.netIndex("L_data");
+	int R_valid = mod.netIndex("R_valid");
+	int R_ready = mod.netIndex("R_ready");
+	int R_data = mod.netIndex("R_data");
+	sim.setAll(mod.reset, 1);
+	sim.step();
+	sim.setAll(mod.reset, 0);
+
+	// every lane sends 0, 1, 2, ... and drains at its own pace, the tokens
+	// have to come out in order
+	vector<uint64_t> sent(lanes, 0), received(lanes, 0);
+	sim.setAll(L_valid, 1);
+	for (int cycle = 0; cycle < 400; cycle++) {
+		for (int lane = 0; lane < lanes; lane++) {
+			sim.set(L_data, lane, sent[lane]);
+			sim.set(R_ready, lane, (cycle/(lane%4 + 1) + lane)%2);
+		}
+		sim.evaluate();
+		for (int lane = 0; lane < lanes; lane++) {
+			if (sim.get(R_valid, lane) and sim.get(R_ready, lane)) {
+				EXPECT_EQ(sim.get(R_data, lane), received[lane]);
+				received[lane]++;
+			}
+			sent[lane] += sim.get(L_ready, lane);
+		}
+		sim.tick();
+	}
+	for (int lane = 0; lane < lanes; lane++) {
+		EXPECT_GT(received[lane], 20u);
+		EXPECT_LE(sent[lane] - received[lane], 6u);
+	}
+}
@@ -0,0 +1,81 @@
+#include <filesystem>
+
+#include <gtest/gtest.h>
+
+#include <flow/module.h>
+#include <flow/simulate.h>
+#include <flow/snapshot.h>
+
+#include "temp.h"
+
+using arithmetic::Expression;
+using namespace clocked;
+
+TEST(Snapshot, Fork) {
+	Module mod;
+	mod.name = "counter";
+	mod.clk = mod.pushNet("clk", Type(Type::TypeName::BITS, 1), Net::Purpose::IN);
+	mod.reset = mod.pushNet("reset", Type(Type::TypeName::BITS, 1), Net::Purpose::IN);
+	int inc = mod.pushNet("inc", Type(Type::TypeName::FIXED, 5), Net::Purpose::IN);
+	int count = mod.pushNet("count", Type(Type::TypeName::FIXED, 13), Net::Purpose::REG);
+	int wide = mod.pushNet("wide", Type(Type::TypeName::FIXED, 64), Net::Purpose::REG);
+	int odd = mod.pushNet("odd", Type(Type::TypeName::FIXED, 1), Net::Purpose::OUT);
+
+	mod.assign.push_back(Assign(odd, Expression::varOf(count) & Expression::intOf(1), true));
+	mod.blocks.push_back(Block(Expression::varOf(mod.clk)));
+	mod.blocks.back().reset.push_back(Assign(count, Expression::intOf(0)));
+	mod.blocks.back().reset.push_back(Assign(wide, Expression::intOf(1)));
+	mod.blocks.back().rules.push_back(Rule({
+		Assign(count, Expression::varOf(count) + Expression::varOf(inc)),
+		Assign(wide, Expression::varOf(wide) * Expression::intOf(3)),
+	}));
+
+	// 13 bit counts straddle the packed words
+	const int lanes = 300;
+	BatchSimulator warm(mod, lanes);
+	warm.setAll(mod.reset, 1);
+	warm.step();
+	warm.setAll(mod.reset, 0);
+	for (int lane = 0; lane < lanes; lane++) {
+		warm.set(inc, lane, lane);
+	}
+	warm.step(1000);
+	EXPECT_EQ(snapshotNets(warm), (vector<int>{mod.clk, mod.reset, inc, count, wide}));
+
+	string path = tempPath("counter.snap");
+	ASSERT_TRUE(checkpoint(warm, path));
+
+	BatchSimulator fork(mod, lanes);
+	bool restored = restore(fork, path);
+	std::filesystem::remove(path);
+	ASSERT_TRUE(restored);
+	for (int lane = 0; lane < lanes; lane++) {
+		EXPECT_EQ(fork.get(inc, lane), warm.get(inc, lane));
+		EXPECT_EQ(fork.get(count, lane), warm.get(count, lane));
+		EXPECT_EQ(fork.get(wide, lane), warm.get(wide, lane));
+		EXPECT_EQ(fork.get(odd, lane), fork.get(count, lane) & 1);
+	}
+
+	// both carry on from the same state
+	warm.step(10);
+	fork.step(10);
+	for (int lane = 0; lane < lanes; lane++) {
+		EXPECT_EQ(fork.get(count, lane), warm.get(count, lane));
+		EXPECT_EQ(fork.get(wide, lane), warm.get(wide, lane));
+	}
+
+	// a single lane forks to every lane
+	BatchSimulator one(mod, 1);
+	EXPECT_FALSE(restore(one, checkpoint(warm)));
+	one.set(inc, 0, 7);
+	one.step(5);
+	ASSERT_TRUE(restore(fork, checkpoint(one)));
+	for (int lane = 0; lane < lanes; lane++) {
+		EXPECT_EQ(fork.get(count, lane), 35u);
+	}
+
+	vector<uint8_t> data = checkpoint(warm);
+	data.resize(data.size() - 8);
+	EXPECT_FALSE(restore(fork, data));
+	EXPECT_EQ(fork.get(count, 0), 35u);
+}
@@ -4,10 +4,12 @@
 
 #include <gtest/gtest.h>
 
+#include <arithmetic/algorithm.h>
 #include <common/mapping.h>
 #include <common/mock_netlist.h>
 #include <flow/func.h>
 #include <flow/module.h>
+#include <flow/pipeline.h>
 #include <flow/synthesize.h>
 #include <interpret_flow/export_dot.h>
 #include <interpret_flow/export_verilog.h>
@@ -31,7 +33,7 @@ const size_t WIDTH = 16;
 const std::filesystem::path TEST_DIR = absolute(current_path() / "tests");
 
 
-parse_verilog::module_def synthesizeVerilogFromFunc(const Func &func) {
+parse_verilog::module_def synthesizeVerilogFromFunc(const Func &func, const SynthesisOptions &options=SynthesisOptions()) {
 	string filenameWithoutExtension = (TEST_DIR / func.name).string();
 	// Render flow diagram
 	{
@@ -50,7 +52,7 @@ parse_verilog::module_def synthesizeVerilogFromFunc(const Func &func) {
 	}
 
 	// Test synthesis
-	clocked::Module mod = synthesizeModuleFromFunc(func);
+	clocked::Module mod = synthesizeModuleFromFunc(func, options);
 	parse_verilog::module_def mod_v = export_module(mod);
 	string verilog = mod_v.to_string();
 	cout << verilog << endl;
@@ -120,6 +122,362 @@ TEST(ModuleSynthesis, Buffer) {
 	EXPECT_SUBSTRING(verilog, "R_state <= L_data;");
 }
 
+TEST(ModuleSynthesis, SkidBuffer) {
+	Func func;
+	func.name = "skid_buffer";
+	Operand L = func.pushNet("L", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	func.nets[R.index].buffering = flow::Net::SKID;
+	Expression exprL(L);
+
+	int branch0 = func.pushCond(Expression::boolOf(true));
+	func.conds[branch0].req(R, exprL);
+	func.conds[branch0].ack(L);
+
+	string verilog = synthesizeVerilogFromFunc(func).to_string();
+	EXPECT_SUBSTRING(verilog, "R_state <= L_data;");
+	EXPECT_SUBSTRING(verilog, "R_queue_slot1");
+	EXPECT_NO_SUBSTRING(verilog, "R_queue_slot2");
+}
+
+TEST(ModuleSynthesis, Fifo) {
+	Func func;
+	func.name = "fifo";
+	Operand L = func.pushNet("L", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	func.nets[R.index].buffering = flow::Net::FIFO;
+	func.nets[R.index].depth = 4;
+	Expression exprL(L);
+
+	int branch0 = func.pushCond(Expression::boolOf(true));
+	func.conds[branch0].req(R, exprL);
+	func.conds[branch0].ack(L);
+
+	string verilog = synthesizeVerilogFromFunc(func).to_string();
+	EXPECT_SUBSTRING(verilog, "R_state <= L_data;");
+	EXPECT_SUBSTRING(verilog, "R_queue_slot3");
+	EXPECT_NO_SUBSTRING(verilog, "R_queue_slot4");
+	EXPECT_SUBSTRING(verilog, "R_queue_head");
+}
+
+TEST(ModuleSynthesis, CreditBuffer) {
+	Func func;
+	func.name = "credit_buffer";
+	Operand L = func.pushNet("L", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	func.nets[L.index].protocol = flow::Net::CREDIT;
+	func.nets[L.index].credits = 3;
+	func.nets[R.index].protocol = flow::Net::CREDIT;
+	func.nets[R.index].credits = 4;
+	Expression exprL(L);
+
+	int branch0 = func.pushCond(Expression::boolOf(true));
+	func.conds[branch0].req(R, exprL);
+	func.conds[branch0].ack(L);
+
+	string verilog = synthesizeVerilogFromFunc(func).to_string();
+	EXPECT_SUBSTRING(verilog, "R_state <= L_queue_data;");
+	EXPECT_SUBSTRING(verilog, "L_queue_slot2");
+	EXPECT_SUBSTRING(verilog, "R_credits <= 4;");
+	EXPECT_NO_SUBSTRING(verilog, "R_ready");
+}
+
+TEST(ModuleSynthesis, Pipeline) {
+	Func func;
+	func.name = "pipeline";
+	Operand A = func.pushNet("A", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand B = func.pushNet("B", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand C = func.pushNet("C", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand D = func.pushNet("D", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Expression exprA(A);
+	Expression exprB(B);
+	Expression exprC(C);
+	Expression exprD(D);
+	Expression request = ((exprA + exprB)*exprC + exprD) % Expression::intOf(65536);
+
+	EXPECT_EQ(pipelineStages(request, 2), 2);
+	EXPECT_EQ(pipelineStages(request, 4), 1);
+	EXPECT_EQ(pipelineStages(exprA, 2), 0);
+
+	// (A+B)*C and D are carried into the second stage
+	vector<vector<Expression> > stages = pipelineExpression(request, 2, 2);
+	ASSERT_EQ(stages.size(), 2u);
+	EXPECT_EQ(stages[0].size(), 2u);
+	EXPECT_EQ(stages[1].size(), 1u);
+
+	int branch0 = func.pushCond(Expression::boolOf(true));
+	func.conds[branch0].req(R, request);
+	func.conds[branch0].ack({A, B, C, D});
+
+	SynthesisOptions options;
+	options.pipelineDepth = 2;
+	string verilog = synthesizeVerilogFromFunc(func, options).to_string();
+	EXPECT_SUBSTRING(verilog, "R_p0_c0_0");
+	EXPECT_SUBSTRING(verilog, "R_p0_c0_1");
+	EXPECT_NO_SUBSTRING(verilog, "R_p1_c0_0");
+	EXPECT_SUBSTRING(verilog, "R_valid_reg <= 1;");
+}
+
+TEST(ModuleSynthesis, SharedOperators) {
+	Func func;
+	func.name = "shared_operators";
+	Operand A = func.pushNet("A", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand B = func.pushNet("B", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand C = func.pushNet("C", Type(Type::TypeName::FIXED, 1), flow::Net::IN);
+	Operand R0 = func.pushNet("R0", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Operand R1 = func.pushNet("R1", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Expression exprA(A);
+	Expression exprB(B);
+	Expression exprC(C);
+
+	int branch0 = func.pushCond(exprC == Expression::intOf(0));
+	func.conds[branch0].req(R0, (exprA + exprB) % Expression::intOf(65536));
+	func.conds[branch0].ack({A, B, C});
+
+	int branch1 = func.pushCond(exprC == Expression::intOf(1));
+	func.conds[branch1].req(R1, (exprA + exprB) % Expression::intOf(65536));
+	func.conds[branch1].ack({A, B, C});
+
+	SynthesisOptions options;
+	options.shareOperators = true;
+	string verilog = synthesizeVerilogFromFunc(func, options).to_string();
+	EXPECT_SUBSTRING(verilog, "R0_state <= shared_1;");
+	EXPECT_SUBSTRING(verilog, "R1_state <= shared_1;");
+	EXPECT_NO_SUBSTRING(verilog, "shared_2");
+}
+
+// Operations of type func anywhere in mod
+int countOperations(const clocked::Module &mod, int func) {
+	vector<const Expression*> exprs;
+	for (auto assign = mod.assign.begin(); assign != mod.assign.end(); assign++) {
+		exprs.push_back(&assign->expr);
+	}
+	for (auto block = mod.blocks.begin(); block != mod.blocks.end(); block++) {
+		for (const vector<clocked::Rule> *rules : {&block->rules, &block->_else}) {
+			for (auto rule = rules->begin(); rule != rules->end(); rule++) {
+				exprs.push_back(&rule->guard);
+				for (auto assign = rule->assign.begin(); assign != rule->assign.end(); assign++) {
+					exprs.push_back(&assign->expr);
+				}
+			}
+		}
+	}
+
+	int count = 0;
+	for (auto e = exprs.begin(); e != exprs.end(); e++) {
+		if ((*e)->top.isExpr()) {
+			for (arithmetic::PostOrderDFSIterator operation_it((*e)->sub, {(*e)->top}); !operation_it.done(); ++operation_it) {
+				count += (operation_it->func == func);
+			}
+		}
+	}
+	return count;
+}
+
+TEST(ModuleSynthesis, SharedAdder) {
+	Func func;
+	func.name = "shared_adder";
+	Operand A = func.pushNet("A", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand B = func.pushNet("B", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand D = func.pushNet("D", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand E = func.pushNet("E", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand C = func.pushNet("C", Type(Type::TypeName::FIXED, 1), flow::Net::IN);
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, WIDTH+1), flow::Net::OUT);
+	Operand S = func.pushNet("S", Type(Type::TypeName::FIXED, 2*WIDTH), flow::Net::OUT);
+	Expression exprC(C);
+
+	// the multiplier only serves branch 0, so it gets no unit
+	int branch0 = func.pushCond(exprC == Expression::intOf(0));
+	func.conds[branch0].req(S, Expression(A) * Expression(B));
+	func.conds[branch0].req(R, (Expression(A) ^ Expression(B)) + Expression(D));
+	func.conds[branch0].ack({A, B, C, D});
+
+	int branch1 = func.pushCond(exprC == Expression::intOf(1));
+	func.conds[branch1].req(R, Expression(D) + Expression(E));
+	func.conds[branch1].ack({C, D, E});
+
+	SynthesisOptions options;
+	EXPECT_EQ(countOperations(synthesizeModuleFromFunc(func, options), Operation::OpType::ADD), 2);
+
+	// one adder, its operands picked by which branch fires
+	options.shareOperators = true;
+	clocked::Module mod = synthesizeModuleFromFunc(func, options);
+	EXPECT_EQ(countOperations(mod, Operation::OpType::ADD), 1);
+	EXPECT_EQ(countOperations(mod, Operation::OpType::TERNARY), 2);
+	EXPECT_GE(mod.netIndex("shared_0"), 0);
+	EXPECT_LT(mod.netIndex("shared_1"), 0);
+	// operands that aren't a net get a wire named after their unit
+	EXPECT_GE(mod.netIndex("shared_0_b0_0"), 0);
+	EXPECT_GE(mod.netIndex("branch_0_fire"), 0);
+	EXPECT_LT(mod.netIndex("branch_1_fire"), 0);
+	synthesizeVerilogFromFunc(func, options);
+}
+
+TEST(ModuleSynthesis, DatapathReset) {
+	Func func;
+	func.name = "datapath_reset";
+	Operand L = func.pushNet("L", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Operand m = func.pushNet("m", Type(Type::TypeName::FIXED, WIDTH), flow::Net::REG);
+	Expression exprL(L);
+	Expression exprm(m);
+
+	int branch0 = func.pushCond(Expression::boolOf(true));
+	func.conds[branch0].req(R, exprL + exprm);
+	func.conds[branch0].mem(m, exprL);
+	func.conds[branch0].ack(L);
+
+	SynthesisOptions options;
+	options.resetDatapath = false;
+	string verilog = synthesizeVerilogFromFunc(func, options).to_string();
+	EXPECT_NO_SUBSTRING(verilog, "R_state <= 0;");
+	EXPECT_SUBSTRING(verilog, "R_valid_reg <= 0;");
+	EXPECT_SUBSTRING(verilog, "m_data <= 0;");
+}
+
+TEST(ModuleSynthesis, PerfCounters) {
+	Func func;
+	func.name = "perf_counters";
+	Operand L = func.pushNet("L", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Expression exprL(L);
+
+	int branch0 = func.pushCond(Expression::boolOf(true));
+	func.conds[branch0].req(R, exprL);
+	func.conds[branch0].ack(L);
+
+	string plain = synthesizeVerilogFromFunc(func).to_string();
+	EXPECT_NO_SUBSTRING(plain, "perf_");
+
+	SynthesisOptions options;
+	options.perfCounters = true;
+	options.counterWidth = 16;
+	clocked::Module mod = synthesizeModuleFromFunc(func, options);
+	for (string name : {"perf_L_stall", "perf_L_idle", "perf_L_xfer", "perf_R_stall", "perf_R_idle", "perf_R_xfer", "perf_branch_0_fires"}) {
+		int net = mod.netIndex(name);
+		ASSERT_GE(net, 0) << name;
+		EXPECT_EQ(mod.nets[net].purpose, clocked::Net::Purpose::REG);
+		EXPECT_EQ(mod.nets[net].type.width, 16);
+	}
+	EXPECT_GE(mod.netIndex("perf_scan"), 0);
+	EXPECT_GE(mod.netIndex("perf_scan_in"), 0);
+	EXPECT_GE(mod.netIndex("perf_scan_out"), 0);
+
+	string verilog = synthesizeVerilogFromFunc(func, options).to_string();
+	EXPECT_SUBSTRING(verilog, "perf_L_stall <= perf_scan_in;");
+	EXPECT_SUBSTRING(verilog, "perf_branch_0_fires <= perf_R_xfer;");
+}
+
+// Counts the events of each kind
+struct CountTrace : TraceSink {
+	int conditionCount = 0;
+	int netCount = 0;
+	int probeCount = 0;
+	int minimizeCount = 0;
+
+	void condition(int cond, const Expression &guard) { conditionCount++; }
+	void net(int funcNet, int data, int valid, int ready) { netCount++; }
+	void probe(int channel, int valid, int data) { probeCount++; }
+	void minimized(const Expression &before, const Expression &after) { minimizeCount++; }
+};
+
+TEST(ModuleSynthesis, Trace) {
+	Func func;
+	func.name = "trace";
+	Operand L = func.pushNet("L", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Expression exprL(L);
+
+	int branch0 = func.pushCond(exprL < Expression::intOf(4));
+	func.conds[branch0].req(R, exprL);
+	func.conds[branch0].ack(L);
+	int branch1 = func.pushCond(exprL >= Expression::intOf(4));
+	func.conds[branch1].ack(L);
+
+	CountTrace sink;
+	Tracer trace(&sink);
+	clocked::Module traced = synthesizeModuleFromFunc(func, SynthesisOptions(), trace);
+	EXPECT_EQ(sink.conditionCount, 2);
+	EXPECT_EQ(sink.netCount, (int)func.nets.size());
+	EXPECT_GT(sink.minimizeCount, 0);
+
+	// tracing never changes what is synthesized
+	NoTrace none;
+	clocked::Module plain = synthesizeModuleFromFunc(func, SynthesisOptions(), none);
+	EXPECT_EQ(traced.nets, plain.nets);
+}
+
+TEST(ModuleSynthesis, ParallelBranches) {
+	Func func;
+	func.name = "parallel_branches";
+	Operand L = func.pushNet("L", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Operand m = func.pushNet("m", Type(Type::TypeName::FIXED, WIDTH), flow::Net::REG);
+	Expression exprL(L);
+	Expression exprm(m);
+
+	for (int i = 0; i < 16; i++) {
+		int branch = func.pushCond(exprm == Expression::intOf(i));
+		func.conds[branch].req(R, exprL*exprL + Expression::intOf(i));
+		func.conds[branch].mem(m, exprm + Expression::intOf(1));
+		func.conds[branch].ack(L);
+	}
+
+	SynthesisOptions options;
+	options.shareOperators = true;
+	string serial = synthesizeVerilogFromFunc(func, options).to_string();
+	options.threads = 4;
+	string parallel = synthesizeVerilogFromFunc(func, options).to_string();
+	EXPECT_EQ(serial, parallel);
+}
+
+TEST(ModuleSynthesis, BranchProfile) {
+	Func func;
+	func.name = "branch_profile";
+	Operand L = func.pushNet("L", Type(Type::TypeName::FIXED, WIDTH), flow::Net::IN);
+	Operand R = func.pushNet("R", Type(Type::TypeName::FIXED, WIDTH), flow::Net::OUT);
+	Operand m = func.pushNet("m", Type(Type::TypeName::FIXED, 2), flow::Net::REG);
+	Expression exprL(L);
+	Expression exprm(m);
+
+	for (int i = 0; i < 4; i++) {
+		int branch = func.pushCond(exprm == Expression::intOf(i));
+		func.conds[branch].req(R, exprL + Expression::intOf(i));
+		func.conds[branch].mem(m, exprm + Expression::intOf(1));
+		func.conds[branch].ack(L);
+	}
+
+	SynthesisOptions options;
+	options.branchProfile = {3, 1, 40, 7};
+	clocked::Module mod = synthesizeModuleFromFunc(func, options);
+
+	// hottest first, each rule still sets the branch_id of its Condition
+	vector<int> order = {2, 3, 0, 1};
+	const clocked::Block &always = mod.blocks.front();
+	ASSERT_EQ(always.rules.size(), order.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		ASSERT_FALSE(always.rules[i].assign.empty());
+		EXPECT_TRUE(areSame(always.rules[i].assign[0].expr, Expression::intOf(order[i])));
+		// the Conditions are exclusive so they make one else-if chain
+		EXPECT_EQ(always.rules[i].isChained, i > 0);
+	}
+	synthesizeVerilogFromFunc(func, options);
+
+	// a Condition that overlaps the chain starts a new one
+	int overlap = func.pushCond(exprL == Expression::intOf(0));
+	func.conds[overlap].req(R, exprL);
+	func.conds[overlap].ack(L);
+	options.branchProfile.push_back(1000);
+	clocked::Module split = synthesizeModuleFromFunc(func, options);
+	ASSERT_EQ(split.blocks.front().rules.size(), 5u);
+	EXPECT_FALSE(split.blocks.front().rules[4].isChained);
+
+	for (const clocked::Rule &rule : synthesizeModuleFromFunc(func).blocks.front().rules) {
+		EXPECT_FALSE(rule.isChained);
+	}
+}
+
 TEST(ModuleSynthesis, Copy) {
 	Func func;
 	func.name = "copy";
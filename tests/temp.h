@@ -0,0 +1,13 @@
+#pragma once
+
+#include <random>
+#include <string>
+
+#include <gtest/gtest.h>
+
+// A path for a file named name in the test temp directory, with a random
+// prefix so that concurrent runs don't share it. Tests remove their files
+// once they are done with them.
+inline std::string tempPath(std::string name) {
+	return ::testing::TempDir() + std::to_string(std::random_device()()) + "_" + name;
+}
@@ -0,0 +1,59 @@
+#include <gtest/gtest.h>
+
+#include <flow/module.h>
+#include <flow/timing.h>
+
+using arithmetic::Expression;
+using namespace clocked;
+
+TEST(ModuleTiming, CriticalPath) {
+	Module mod;
+	mod.name = "critical_path";
+	mod.clk = mod.pushNet("clk", Type(Type::TypeName::BITS, 1), Net::Purpose::IN);
+	int x = mod.pushNet("x", Type(Type::TypeName::FIXED, 8), Net::Purpose::IN);
+	int y = mod.pushNet("y", Type(Type::TypeName::FIXED, 8), Net::Purpose::IN);
+	int z = mod.pushNet("z", Type(Type::TypeName::FIXED, 8), Net::Purpose::IN);
+	int a = mod.pushNet("a", Type(Type::TypeName::FIXED, 8), Net::Purpose::WIRE);
+	int b = mod.pushNet("b", Type(Type::TypeName::FIXED, 8), Net::Purpose::WIRE);
+	int r = mod.pushNet("r", Type(Type::TypeName::FIXED, 8), Net::Purpose::REG);
+	int o = mod.pushNet("o", Type(Type::TypeName::FIXED, 8), Net::Purpose::OUT);
+
+	mod.assign.push_back(Assign(a, Expression::varOf(x) + Expression::varOf(y), true));
+	mod.assign.push_back(Assign(b, Expression::varOf(a) & Expression::varOf(z), true));
+	mod.assign.push_back(Assign(o, ~Expression::varOf(r), true));
+
+	mod.blocks.push_back(Block(Expression::varOf(mod.clk)));
+	mod.blocks.back().rules.push_back(Rule({
+		Assign(r, Expression::varOf(b) + Expression::intOf(1)),
+	}, Expression::varOf(a) != Expression::intOf(0)));
+
+	TimingReport report = analyzeTiming(mod);
+	EXPECT_TRUE(report.loops.empty());
+	EXPECT_DOUBLE_EQ(report.arrival[a], 1.0);
+	EXPECT_DOUBLE_EQ(report.arrival[b], 2.0);
+	EXPECT_DOUBLE_EQ(report.depth(), 3.0);
+	ASSERT_EQ(report.paths.size(), 2u);
+	EXPECT_EQ(report.paths[0].nets, (vector<int>{x, a, b, r}));
+	EXPECT_EQ(report.paths[1].nets, (vector<int>{r, o}));
+	EXPECT_EQ(report.paths[0].to_string(mod), "3: x -> a -> b -> r");
+
+	// a drives both b and the guard
+	report = analyzeTiming(mod, 1, DelayModel(1.0, 0.5));
+	ASSERT_EQ(report.paths.size(), 1u);
+	EXPECT_DOUBLE_EQ(report.depth(), 3.5);
+}
+
+TEST(ModuleTiming, CombinationalLoop) {
+	Module mod;
+	mod.name = "combinational_loop";
+	int x = mod.pushNet("x", Type(Type::TypeName::FIXED, 1), Net::Purpose::IN);
+	int c = mod.pushNet("c", Type(Type::TypeName::FIXED, 1), Net::Purpose::WIRE);
+	int d = mod.pushNet("d", Type(Type::TypeName::FIXED, 1), Net::Purpose::WIRE);
+
+	mod.assign.push_back(Assign(c, Expression::varOf(x) & Expression::varOf(d), true));
+	mod.assign.push_back(Assign(d, ~Expression::varOf(c), true));
+
+	TimingReport report = analyzeTiming(mod);
+	EXPECT_EQ(report.loops, (vector<int>{c, d}));
+	EXPECT_DOUBLE_EQ(report.arrival[x], 0.0);
+}
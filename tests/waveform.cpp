@@ -0,0 +1,69 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+#include <flow/module.h>
+#include <flow/simulate.h>
+#include <flow/waveform.h>
+
+#include "temp.h"
+
+using arithmetic::Expression;
+using namespace clocked;
+
+TEST(Waveform, Handshake) {
+	Module mod;
+	mod.name = "handshake";
+	mod.clk = mod.pushNet("clk", Type(Type::TypeName::BITS, 1), Net::Purpose::IN);
+	mod.reset = mod.pushNet("reset", Type(Type::TypeName::BITS, 1), Net::Purpose::IN);
+	int count = mod.pushNet("count", Type(Type::TypeName::FIXED, 8), Net::Purpose::REG);
+	int valid = mod.pushNet("R_valid", Type(Type::TypeName::BITS, 1), Net::Purpose::OUT);
+	int data = mod.pushNet("R_data", Type(Type::TypeName::FIXED, 8), Net::Purpose::OUT);
+
+	mod.assign.push_back(Assign(valid, Expression::varOf(count) & Expression::intOf(1), true));
+	mod.assign.push_back(Assign(data, Expression::varOf(count) >> Expression::intOf(1), true));
+	mod.blocks.push_back(Block(Expression::varOf(mod.clk)));
+	mod.blocks.back().reset.push_back(Assign(count, Expression::intOf(0)));
+	mod.blocks.back().rules.push_back(Rule({
+		Assign(count, Expression::varOf(count) + Expression::intOf(1)),
+	}));
+
+	string wavePath = tempPath("handshake.wave");
+	string vcdPath = tempPath("handshake.vcd");
+
+	BatchSimulator sim(mod, 8);
+	WaveformWriter wave;
+	// small blocks so the writer thread has to keep up
+	ASSERT_TRUE(wave.open(sim, wavePath, 3, WaveformWriter::CHANNELS, 64));
+	EXPECT_EQ(wave.nets, (vector<int>{valid, data}));
+	for (int cycle = 0; cycle < 1000; cycle++) {
+		sim.evaluate();
+		wave.sample(cycle*10);
+		sim.tick();
+	}
+	wave.close();
+	EXPECT_FALSE(wave.isOpen());
+
+	ASSERT_TRUE(exportVcd(wavePath, vcdPath));
+	std::ifstream vcd(vcdPath);
+	std::stringstream text;
+	text << vcd.rdbuf();
+	string dump = text.str();
+	vcd.close();
+	std::filesystem::remove(wavePath);
+	std::filesystem::remove(vcdPath);
+
+	EXPECT_NE(dump.find("$scope module handshake $end"), string::npos);
+	EXPECT_NE(dump.find("$var wire 1 ! R_valid $end"), string::npos);
+	EXPECT_NE(dump.find("$var wire 8 \" R_data $end"), string::npos);
+	EXPECT_EQ(dump.find("count"), string::npos);
+	// valid rises every other cycle, data counts up when it falls
+	EXPECT_NE(dump.find("#10\n1!\n#20\n0!\nb1 \"\n#30\n1!\n"), string::npos);
+	EXPECT_NE(dump.find("#9990\n1!\n"), string::npos);
+
+	std::stringstream garbage("not a waveform");
+	std::stringstream out;
+	EXPECT_FALSE(exportVcd(garbage, out));
+}